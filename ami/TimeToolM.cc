@@ -35,6 +35,67 @@ typedef Pds::EvrData::DataV3 EvrDataType;
 
 static const int   cols  = Pds::Opal1k::ConfigV1::Column_Pixels;
 
+//
+//  Each ROI channel occupies a consecutive block of NFEATURES cache
+//  entries following those of the primary ROI
+//
+static const unsigned NFEATURES = 7;
+
+static int _cache_names(Ami::FeatureCache& cache, const TimeTool::Fex& fex)
+{
+  int index = cache.add(fex.base_name()+":AMI:AMPL");
+  cache.add(fex.base_name()+":AMI:FLTPOS");
+  cache.add(fex.base_name()+":AMI:FLTPOS_PS");
+  cache.add(fex.base_name()+":AMI:FLTPOSFWHM");
+  cache.add(fex.base_name()+":AMI:AMPLNXT");
+  cache.add(fex.base_name()+":AMI:REFAMPL");
+  cache.add(fex.base_name()+":AMI:SIGROISUM");
+  return index;
+}
+
+static void _cache_values(Ami::FeatureCache& cache, int index, const TimeTool::Fex& fex)
+{
+  cache.cache(index+0, fex.amplitude());
+  cache.cache(index+1, fex.filtered_position());
+  cache.cache(index+2, fex.filtered_pos_ps());
+  cache.cache(index+3, fex.filtered_fwhm());
+  cache.cache(index+4, fex.next_amplitude());
+  cache.cache(index+5, fex.ref_amplitude());
+  cache.cache(index+6, fex.sig_roi_sum());
+}
+
+//
+//  The edges of the multiple edge detector (num_edges) of each ROI
+//  follow the blocks of the ROIs, NEDGEFEATURES entries per edge.
+//  Edges not found in an event are cached as zero.
+//
+static const unsigned NEDGEFEATURES = 4;
+
+static void _cache_edge_names(Ami::FeatureCache& cache, const TimeTool::Fex& fex)
+{
+  char buff[32];
+  for(unsigned k=0; k<fex.m_num_edges; k++) {
+    sprintf(buff,":AMI:EDGE%u",k);
+    string name = fex.base_name()+buff;
+    cache.add(name+":FLTPOS");
+    cache.add(name+":FLTPOS_PS");
+    cache.add(name+":AMPL");
+    cache.add(name+":FLTPOSFWHM");
+  }
+}
+
+static int _cache_edge_values(Ami::FeatureCache& cache, int index, const TimeTool::Fex& fex)
+{
+  for(unsigned k=0; k<fex.m_num_edges; k++, index+=NEDGEFEATURES) {
+    bool found = k<fex.nedges();
+    cache.cache(index+0, found ? fex.edge(k).position    : 0.);
+    cache.cache(index+1, found ? fex.edge(k).position_ps : 0.);
+    cache.cache(index+2, found ? fex.edge(k).amplitude   : 0.);
+    cache.cache(index+3, found ? fex.edge(k).fwhm        : 0.);
+  }
+  return index;
+}
+
 //
 //  Create all plot entries
 //
@@ -71,16 +132,25 @@ namespace Ami {
       for(unsigned k=0; k<wf.size(); k++)
         _flt_signal->content(wf[k],k);
     }
+    void _monitor_sub_sig (const ndarray<const float,1>& wf)
+    {
+      for(unsigned k=0; k<wf.size(); k++)
+        _sub_signal->content(wf[k],k);
+    }
+    void _monitor_flt_sig (const ndarray<const float,1>& wf)
+    {
+      for(unsigned k=0; k<wf.size(); k++)
+        _flt_signal->content(wf[k],k);
+    }
   public:
     int cache(Ami::FeatureCache& cache) {
       _cache = &cache;
-      _cache_index = cache.add(base_name()+":AMI:AMPL");
-      cache.add(base_name()+":AMI:FLTPOS");
-      cache.add(base_name()+":AMI:FLTPOS_PS");
-      cache.add(base_name()+":AMI:FLTPOSFWHM");
-      cache.add(base_name()+":AMI:AMPLNXT");
-      cache.add(base_name()+":AMI:REFAMPL");
-      cache.add(base_name()+":AMI:SIGROISUM");
+      _cache_index = _cache_names(cache, *this);
+      for(unsigned j=0; j<m_channels.size(); j++)
+        _cache_names(cache, *m_channels[j]);
+      _cache_edge_names(cache, *this);
+      for(unsigned j=0; j<m_channels.size(); j++)
+        _cache_edge_names(cache, *m_channels[j]);
       return _cache_index;
     }
     void configure() {
@@ -160,13 +230,13 @@ namespace Ami {
                                _ipmdata);
 
         if (_cache) {
-          _cache->cache(_cache_index+0, amplitude());
-          _cache->cache(_cache_index+1, filtered_position());
-          _cache->cache(_cache_index+2, filtered_pos_ps());
-          _cache->cache(_cache_index+3, filtered_fwhm());
-          _cache->cache(_cache_index+4, next_amplitude());
-          _cache->cache(_cache_index+5, ref_amplitude());
-          _cache->cache(_cache_index+6, sig_roi_sum());
+          _cache_values(*_cache, _cache_index, *this);
+          for(unsigned j=0; j<m_channels.size(); j++)
+            _cache_values(*_cache, _cache_index+NFEATURES*(j+1), *m_channels[j]);
+          int index = _cache_index+NFEATURES*(m_channels.size()+1);
+          index = _cache_edge_values(*_cache, index, *this);
+          for(unsigned j=0; j<m_channels.size(); j++)
+            index = _cache_edge_values(*_cache, index, *m_channels[j]);
         }
 
         if (status()) {
@@ -1,4 +1,4 @@
-tgtnames    := timetool timetooldb
+tgtnames    := timetool timetooldb ttbench tttest
 
 tgtsrcs_timetool := timetool.cc
 tgtlibs_timetool := pds/utility pds/collection pds/service pds/vmon pds/mon pds/xtc
@@ -16,3 +16,17 @@ tgtlibs_timetooldb += pdsdata/xtcdata pdsdata/anadata pdsdata/compressdata pdsda
 tgtlibs_timetooldb += gsl/gsl gsl/gslcblas
 tgtslib_timetooldb := ${USRLIBDIR}/rt ${USRLIBDIR}/pthread
 tgtincs_timetooldb := pdsdata/include psalg/include boost/include ndarray/include
+
+tgtsrcs_ttbench := ttbench.cc
+tgtlibs_ttbench := timetool/ttsvc
+tgtlibs_ttbench += pdsdata/xtcdata pdsdata/psddl_pdsdata psalg/psalg
+tgtlibs_ttbench += gsl/gsl gsl/gslcblas
+tgtslib_ttbench := ${USRLIBDIR}/rt
+tgtincs_ttbench := pdsdata/include psalg/include boost/include ndarray/include
+
+tgtsrcs_tttest := tttest.cc
+tgtlibs_tttest := timetool/ttsvc
+tgtlibs_tttest += pdsdata/xtcdata pdsdata/psddl_pdsdata psalg/psalg
+tgtlibs_tttest += gsl/gsl gsl/gslcblas
+tgtslib_tttest := ${USRLIBDIR}/rt
+tgtincs_tttest := pdsdata/include psalg/include boost/include ndarray/include
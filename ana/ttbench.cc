@@ -0,0 +1,535 @@
+//
+//  Benchmark of the timetool processing kernels on synthetic data.
+//
+#include "timetool/service/Fex.hh"
+#include "timetool/service/Filter.hh"
+#include "timetool/service/Projector.hh"
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+
+using namespace TimeTool;
+
+static const char* isas[] = { "scalar", "sse4", "avx2", "avx512", NULL };
+
+void usage(char* progname) {
+  fprintf(stderr,
+          "Usage: %s [-r <rows>] [-c <columns>] [-n <iterations>]\n",
+          progname);
+}
+
+static double now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return double(ts.tv_sec)+1.e-9*double(ts.tv_nsec);
+}
+
+//
+//  Project the same frame onto each axis with each supported kernel
+//  set and report the throughput in pixels per second
+//
+static void bench_projection(const ndarray<const uint16_t,2>& frame,
+                             unsigned niter)
+{
+  unsigned lo[2] = { 0, 0 };
+  unsigned hi[2] = { frame.shape()[0]-1, frame.shape()[1]-1 };
+  unsigned npix  = frame.shape()[0]*frame.shape()[1];
+
+  std::vector<int>    proj (frame.shape()[0] > frame.shape()[1] ?
+                            frame.shape()[0] : frame.shape()[1]);
+  std::vector<double> projd(proj.size());
+
+  printf("Projection of %ux%u frame [%u iterations]\n",
+         frame.shape()[0], frame.shape()[1], niter);
+  printf("%8.8s  %12.12s  %12.12s\n", "isa", "X [Mpix/s]", "Y [Mpix/s]");
+
+  const char* dflt = Projector::isa();
+  for(const char** isa = isas; *isa; isa++) {
+    if (!Projector::isa(*isa))
+      continue;
+    double rate[2];
+    for(unsigned pdim=0; pdim<2; pdim++) {
+      double vmax;
+      double t0 = now();
+      for(unsigned i=0; i<niter; i++)
+        Projector::project(frame, lo, hi, 32, pdim, NULL,
+                           &proj[0], &projd[0], vmax);
+      double dt = now()-t0;
+      rate[pdim] = 1.e-6*double(npix)*double(niter)/dt;
+    }
+    printf("%8.8s  %12.1f  %12.1f\n", *isa, rate[1], rate[0]);
+  }
+  Projector::isa(dflt);
+}
+
+//
+//  Filter a projection with the direct and overlap-save FFT methods for
+//  a range of weight counts and report the time per event
+//
+static void bench_filter(unsigned nsignal,
+                         unsigned niter)
+{
+  static const unsigned nweights[] = { 16, 32, 64, 100, 128, 256, 0 };
+
+  std::vector<double> signal(nsignal);
+  for(unsigned i=0; i<nsignal; i++)
+    signal[i] = double(rand())/double(RAND_MAX);
+  std::vector<double> out(nsignal);
+
+  printf("Filter of %u samples [%u iterations]\n", nsignal, niter);
+  printf("%8.8s  %12.12s  %12.12s  %6.6s  %6.6s  %6.6s\n",
+         "weights", "direct [us]", "fft [us]", "block", "auto", "float");
+
+  for(const unsigned* nw = nweights; *nw; nw++) {
+    if (*nw > nsignal)
+      continue;
+    std::vector<double> weights(*nw);
+    for(unsigned i=0; i<*nw; i++)
+      weights[i] = i < *nw/2 ? 1./double(*nw) : -1./double(*nw);
+
+    double t[2];
+    unsigned imax;
+    Filter f[2];
+    f[0].configure(&weights[0], *nw, nsignal, Filter::Direct);
+    f[1].configure(&weights[0], *nw, nsignal, Filter::FFT);
+    for(unsigned m=0; m<2; m++) {
+      double t0 = now();
+      for(unsigned i=0; i<niter; i++)
+        f[m].apply(&signal[0], nsignal, &out[0], imax);
+      t[m] = 1.e6*(now()-t0)/double(niter);
+    }
+
+    Filter a[2];
+    a[0].configure(&weights[0], *nw, nsignal, Filter::Auto, Filter::Double);
+    a[1].configure(&weights[0], *nw, nsignal, Filter::Auto, Filter::Single);
+    printf("%8u  %12.2f  %12.2f  %6u  %6.6s  %6.6s\n",
+           *nw, t[0], t[1], f[1].block(),
+           a[0].method()==Filter::FFT ? "fft" : "direct",
+           a[1].method()==Filter::FFT ? "fft" : "direct");
+  }
+}
+
+//
+//  Filter a noisy step edge with the direct method in double, single
+//  and fixed point precision.  Report the time per event, and for the
+//  fixed point filter the largest difference of the filter output and
+//  the difference of the fitted edge position from double (the single
+//  precision filter is checked by tttest).
+//
+static void bench_precision(unsigned nsignal,
+                            unsigned niter)
+{
+  static const unsigned nweights[] = { 16, 32, 64, 100, 128, 256, 0 };
+  static const Filter::Precision prec[] = { Filter::Double, Filter::Single, Filter::Fixed };
+
+  std::vector<double> signal(nsignal);
+  for(unsigned i=0; i<nsignal; i++)
+    signal[i] = (i < nsignal/3 ? 0. : 0.2) +
+      0.01*(double(rand())/double(RAND_MAX)-0.5);
+  std::vector<float>  fsignal(signal.begin(), signal.end());
+  std::vector<float>  fout(nsignal);
+  std::vector<double> out[3];
+  for(unsigned m=0; m<3; m++)
+    out[m].resize(nsignal);
+
+  printf("Filter precision of %u samples [%u iterations]\n", nsignal, niter);
+  printf("%8.8s  %12.12s  %12.12s  %12.12s  %12.12s  %12.12s\n",
+         "weights", "double [us]", "float [us]", "fixed [us]",
+         "fixed |dq|", "fixed dpos");
+
+  for(const unsigned* nw = nweights; *nw; nw++) {
+    if (*nw > nsignal)
+      continue;
+    std::vector<double> weights(*nw);
+    for(unsigned i=0; i<*nw; i++)
+      weights[i] = i < *nw/2 ? -1./double(*nw) : 1./double(*nw);
+
+    double   t  [3];
+    double   pos[3];
+    unsigned imax[3];
+    unsigned n = 0;
+    Filter f[3];
+    for(unsigned m=0; m<3; m++) {
+      f[m].configure(&weights[0], *nw, nsignal, Filter::Direct, prec[m]);
+      double t0 = now();
+      for(unsigned i=0; i<niter; i++)
+        n = prec[m]==Filter::Single ?
+          f[m].apply(&fsignal[0], nsignal, &fout[0], imax[m]) :
+          f[m].apply(&signal[0], nsignal, &out[m][0], imax[m]);
+      t[m] = 1.e6*(now()-t0)/double(niter);
+      if (prec[m]==Filter::Single)
+        continue;
+
+      unsigned pk[2];
+      double   r [3] = { 0, 0, 0 };
+      if (Filter::peaks(&out[m][0], n, imax[m], 0.5, pk))
+        Filter::parab_fit(&out[m][0], n, pk[0], 0.8, r);
+      pos[m] = r[1];
+    }
+
+    double dq = 0;
+    for(unsigned i=0; i<n; i++)
+      if (fabs(out[2][i]-out[0][i]) > dq)
+        dq = fabs(out[2][i]-out[0][i]);
+
+    printf("%8u  %12.2f  %12.2f  %12.2f  %12.3g  %12.3g\n",
+           *nw, t[0], t[1], t[2], dq, pos[2]-pos[0]);
+  }
+}
+
+//
+//  Find a noisy step edge with the full resolution filter and with the
+//  coarse-to-fine search: the edge is located with the decimated filter
+//  and the full resolution filter is applied within a window around it.
+//  Report the time per event and the difference of the edge position.
+//
+static void _edge(const double* q, unsigned n, unsigned imax, double& pos)
+{
+  unsigned pk[2];
+  double   r [3] = { 0, 0, 0 };
+  if (Filter::peaks(q, n, imax, 0.5, pk))
+    Filter::parab_fit(q, n, pk[0], 0.8, r);
+  pos = r[1];
+}
+
+static void bench_coarse(unsigned nsignal,
+                         unsigned niter)
+{
+  static const unsigned factors[] = { 2, 4, 8, 0 };
+  const unsigned nw   = 64;
+  const unsigned hwin = 64;
+
+  std::vector<double> signal(nsignal), weights(nw);
+  for(unsigned i=0; i<nsignal; i++)
+    signal[i] = (i < nsignal/3 ? 0. : 0.2) +
+      0.01*(double(rand())/double(RAND_MAX)-0.5);
+  for(unsigned i=0; i<nw; i++)
+    weights[i] = i < nw/2 ? -1./double(nw) : 1./double(nw);
+
+  std::vector<double> out(nsignal), sc(nsignal), wc(nw), qc(nsignal);
+  unsigned imax;
+  double   pos0;
+  Filter f;
+  f.configure(&weights[0], nw, nsignal, Filter::Direct);
+
+  double t0 = now();
+  for(unsigned i=0; i<niter; i++) {
+    unsigned n = f.apply(&signal[0], nsignal, &out[0], imax);
+    _edge(&out[0], n, imax, pos0);
+  }
+  double t = 1.e6*(now()-t0)/double(niter);
+
+  printf("Coarse-to-fine edge search of %u samples [%u iterations]\n", nsignal, niter);
+  printf("%8.8s  %12.12s  %12.12s\n", "factor", "time [us]", "dpos");
+  printf("%8u  %12.2f  %12.3g\n", 1, t, 0.);
+
+  for(const unsigned* d = factors; *d; d++) {
+    unsigned nwc = Filter::decimate(&weights[0], nw, *d, &wc[0]);
+    Filter c;
+    c.configure(&wc[0], nwc, nsignal/ *d, Filter::Direct);
+
+    double pos = 0;
+    t0 = now();
+    for(unsigned i=0; i<niter; i++) {
+      unsigned nc = Filter::decimate(&signal[0], nsignal, *d, &sc[0]);
+      c.apply(&sc[0], nc, &qc[0], imax);
+      unsigned nout = nsignal-nw+1;
+      unsigned m  = imax* *d;
+      unsigned lo = m > hwin ? m-hwin : 0;
+      unsigned hi = m+ *d+hwin < nout ? m+ *d+hwin : nout;
+      f.apply(&signal[lo], hi-lo+nw-1, &out[lo], imax);
+      _edge(&out[lo], hi-lo, imax, pos);
+      pos += lo;
+    }
+    t = 1.e6*(now()-t0)/double(niter);
+    printf("%8u  %12.2f  %12.3g\n", *d, t, pos-pos0);
+  }
+}
+
+//
+//  Select the highest peaks of a filter output with many peaks above
+//  threshold, with the two peak search and with the heap of k peaks,
+//  and report the time per event
+//
+static void bench_peaks(unsigned nsignal,
+                        unsigned niter)
+{
+  static const unsigned ks[] = { 2, 4, 8, 16, 0 };
+
+  std::vector<double> q(nsignal);
+  for(unsigned i=0; i<nsignal; i++)
+    q[i] = 1. + sin(double(i)*0.2) + 0.1*double(rand())/double(RAND_MAX);
+  unsigned imax = 0;
+  for(unsigned i=1; i<nsignal; i++)
+    if (q[i] > q[imax])
+      imax = i;
+
+  printf("Peak selection of %u samples [%u iterations]\n", nsignal, niter);
+  printf("%8.8s  %12.12s\n", "peaks", "time [us]");
+
+  unsigned pk[16];
+  double t0 = now();
+  for(unsigned i=0; i<niter; i++)
+    Filter::peaks(&q[0], nsignal, imax, 0.5, pk);
+  printf("%8.8s  %12.2f\n", "2 (pair)", 1.e6*(now()-t0)/double(niter));
+
+  for(const unsigned* k = ks; *k; k++) {
+    t0 = now();
+    for(unsigned i=0; i<niter; i++)
+      Filter::peaks(&q[0], nsignal, imax, 0.5, *k, 0, pk);
+    printf("%8u  %12.2f\n", *k, 1.e6*(now()-t0)/double(niter));
+  }
+}
+
+//
+//  Normalize a full ROI by the reference with a per-pixel division and
+//  with a multiply by the precomputed reciprocal and report the time
+//  per event
+//
+static void bench_reference(unsigned npix,
+                            unsigned niter)
+{
+  std::vector<double> sig(npix), ref(npix), rinv(npix);
+  for(unsigned i=0; i<npix; i++) {
+    ref [i] = 1. + double(rand())/double(RAND_MAX);
+    rinv[i] = 1./ref[i];
+  }
+
+  printf("Reference normalization of %u pixels [%u iterations]\n", npix, niter);
+  printf("%12.12s  %14.14s\n", "divide [us]", "multiply [us]");
+
+  double t[2];
+  for(unsigned m=0; m<2; m++) {
+    for(unsigned i=0; i<npix; i++)
+      sig[i] = double(rand())/double(RAND_MAX);
+    double t0 = now();
+    for(unsigned k=0; k<niter; k++) {
+      if (m==0)
+        for(unsigned i=0; i<npix; i++)
+          sig[i] = sig[i]/ref[i] - 1.;
+      else
+        for(unsigned i=0; i<npix; i++)
+          sig[i] = sig[i]*rinv[i] - 1.;
+    }
+    t[m] = 1.e6*(now()-t0)/double(niter);
+  }
+  printf("%12.2f  %14.2f\n", t[0], t[1]);
+}
+
+//
+//  A Fex monitoring the full region, for which the corrected double
+//  precision regions are made for every event
+//
+class FullMonitor : public Fex {
+public:
+  FullMonitor(const char* fname, const char* dir) : Fex(fname, false, false, dir) {}
+  bool monitors_full() const { return true; }
+};
+
+//
+//  Analyse full ROI signal events with a sideband through the corrected
+//  double precision regions and streamed, and report the peak workspace
+//  working set and the time per event
+//
+static void bench_streaming(unsigned rows,
+                            unsigned cols,
+                            unsigned niter)
+{
+  char dir[] = "/tmp/ttbenchXXXXXX";
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return;
+  }
+  std::string path = std::string(dir)+"/streaming.input";
+  FILE* f = fopen(path.c_str(),"w");
+  if (!f) {
+    perror(path.c_str());
+    return;
+  }
+  fprintf(f,
+          "project X\nuse_full_roi true\nsig_top %u\nsig_bot %u\n"
+          "sb_top %u\nsb_bot %u\nspec_begin 20\nspec_end %u\nweights",
+          rows/2, rows*3/4-1, rows/4, rows/2-1, cols-21);
+  for(unsigned i=0; i<80; i++)
+    fprintf(f," %g", (i<40 ? 0.5:-0.5)/40.);
+  fprintf(f,"\n");
+  fclose(f);
+
+  std::vector<uint16_t> buff(rows*cols);
+  for(unsigned i=0; i<buff.size(); i++)
+    buff[i] = 32 + (rand()&0x3ff);
+  unsigned shape[] = { rows, cols };
+  ndarray<const uint16_t,2> frame(&buff[0], shape);
+
+  //  The first event is a reference, the rest are signal
+  Pds::EvrData::FIFOEvent fifo[2] = { Pds::EvrData::FIFOEvent(0,0,140),
+                                      Pds::EvrData::FIFOEvent(0,0,162) };
+  unsigned fs_ref[] = { 2 }, fs_sig[] = { 1 };
+  ndarray<const Pds::EvrData::FIFOEvent,1> ref(fifo, fs_ref);
+  ndarray<const Pds::EvrData::FIFOEvent,1> sig(fifo, fs_sig);
+
+  printf("Full ROI signal events of %ux%u pixels with sideband [%u iterations]\n",
+         rows/4, cols-40, niter);
+  printf("%8.8s  %14.14s  %10.10s\n", "", "peak ws [kB]", "time [us]");
+
+  FullMonitor copy  (path.c_str(), dir);
+  Fex         stream(path.c_str(), false, false, dir);
+  Fex* fex[] = { &copy, &stream };
+  static const char* names[] = { "copy", "stream" };
+  for(unsigned m=0; m<2; m++) {
+    fex[m]->configure();
+    fex[m]->reset();
+    fex[m]->analyze(frame, ref, 0);
+    unsigned long ws = 0;
+    double t0 = now();
+    for(unsigned k=0; k<niter; k++) {
+      fex[m]->reset();
+      fex[m]->analyze(frame, sig, 0);
+      if (fex[m]->working_set() > ws)
+        ws = fex[m]->working_set();
+    }
+    double t = 1.e6*(now()-t0)/double(niter);
+    printf("%8.8s  %14.1f  %10.2f\n", names[m], double(ws)/1024., t);
+  }
+
+  unlink(path.c_str());
+  rmdir(dir);
+}
+
+//
+//  Analyse a sequence of distinct frames one call per frame and in one
+//  batch, and report the time per frame
+//
+static void bench_batch(unsigned rows,
+                        unsigned cols,
+                        unsigned niter)
+{
+  static const unsigned NFRAMES = 32;
+
+  char dir[] = "/tmp/ttbenchXXXXXX";
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return;
+  }
+  std::string path = std::string(dir)+"/batch.input";
+  FILE* f = fopen(path.c_str(),"w");
+  if (!f) {
+    perror(path.c_str());
+    return;
+  }
+  fprintf(f,
+          "project X\nsig_top %u\nsig_bot %u\n"
+          "spec_begin 20\nspec_end %u\nweights",
+          rows*2/5, rows*3/5, cols-21);
+  for(unsigned i=0; i<80; i++)
+    fprintf(f," %g", (i<40 ? 0.5:-0.5)/40.);
+  fprintf(f,"\n");
+  fclose(f);
+
+  std::vector< std::vector<uint16_t> > buff(NFRAMES);
+  std::vector< ndarray<const uint16_t,2> > frames(NFRAMES);
+  std::vector< ndarray<const Pds::EvrData::FIFOEvent,1> > fifos(NFRAMES);
+  unsigned shape[] = { rows, cols };
+  //  The first frame is a reference (event code 162 present), the rest
+  //  are signal
+  Pds::EvrData::FIFOEvent fifo[2] = { Pds::EvrData::FIFOEvent(0,0,140),
+                                      Pds::EvrData::FIFOEvent(0,0,162) };
+  unsigned fs_ref[] = { 2 }, fs_sig[] = { 1 };
+  for(unsigned k=0; k<NFRAMES; k++) {
+    buff[k].resize(rows*cols);
+    for(unsigned i=0; i<buff[k].size(); i++)
+      buff[k][i] = 32 + (rand()&0x3ff);
+    frames[k] = ndarray<const uint16_t,2>(&buff[k][0], shape);
+    fifos [k] = ndarray<const Pds::EvrData::FIFOEvent,1>(fifo, k ? fs_sig : fs_ref);
+  }
+
+  Fex fex(path.c_str(), false, false, dir);
+  fex.configure();
+  Fex::BatchResults results;
+
+  printf("Analysis of %u %ux%u frames [%u iterations]\n", NFRAMES, rows, cols, niter);
+  printf("%12.12s  %12.12s\n", "frame [us]", "batch [us]");
+
+  double t[2];
+  for(unsigned m=0; m<2; m++) {
+    double t0 = now();
+    for(unsigned k=0; k<niter; k++) {
+      if (m==0)
+        for(unsigned i=0; i<NFRAMES; i++) {
+          fex.reset();
+          fex.analyze(frames[i], fifos[i], 0);
+        }
+      else
+        fex.analyze_batch(&frames[0], &fifos[0], NULL, NFRAMES, results);
+    }
+    t[m] = 1.e6*(now()-t0)/double(niter*NFRAMES);
+  }
+  printf("%12.2f  %12.2f\n", t[0], t[1]);
+
+  unlink(path.c_str());
+  rmdir(dir);
+}
+
+int main(int argc, char* argv[]) {
+  int c;
+  unsigned rows  = 1024;
+  unsigned cols  = 1024;
+  unsigned niter = 1000;
+  unsigned parseErr = 0;
+
+  while ((c = getopt(argc, argv, "hr:c:n:")) != -1) {
+    switch (c) {
+    case 'h':
+      usage(argv[0]);
+      exit(0);
+    case 'r':
+      rows = atoi(optarg);
+      break;
+    case 'c':
+      cols = atoi(optarg);
+      break;
+    case 'n':
+      niter = atoi(optarg);
+      break;
+    default:
+      parseErr++;
+    }
+  }
+
+  if (!(parseErr==0 && rows && cols && niter)) {
+    usage(argv[0]);
+    exit(2);
+  }
+
+  std::vector<uint16_t> buff(rows*cols);
+  for(unsigned i=0; i<buff.size(); i++)
+    buff[i] = 32 + (rand()&0x3ff);
+
+  unsigned shape[] = { rows, cols };
+  ndarray<const uint16_t,2> frame(&buff[0], shape);
+
+  bench_projection(frame, niter);
+
+  bench_filter(cols, niter);
+
+  bench_precision(cols, niter);
+
+  bench_coarse(cols, niter);
+
+  bench_peaks(cols, niter);
+
+  bench_reference(rows*cols, niter);
+
+  bench_streaming(rows, cols, niter);
+
+  bench_batch(rows, cols, niter/10 ? niter/10 : 1);
+
+  return 0;
+}
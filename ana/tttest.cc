@@ -0,0 +1,708 @@
+//
+//  Regression tests of the timetool processing on synthetic or recorded
+//  frames.  Each test prints its result; the exit status is the number
+//  of failed tests.
+//
+#include "timetool/service/Fex.hh"
+#include "timetool/service/Filter.hh"
+#include "timetool/service/Projector.hh"
+
+#include "psalg/psalg.h"
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+using namespace TimeTool;
+
+static const unsigned ROWS = 1024;
+static const unsigned COLS = 1024;
+
+static char _dir[] = "/tmp/tttestXXXXXX";
+
+//
+//  Frames for the regression tests against psalg and the allocation
+//  test: synthetic, or recorded frames of rows x cols 16-bit pixels
+//
+static std::vector< std::vector<uint16_t> > _frames;
+static unsigned _rows = ROWS;
+static unsigned _cols = COLS;
+
+void usage(char* progname) {
+  fprintf(stderr,
+          "Usage: %s [-f <frames file> -r <rows> -c <columns>]\n",
+          progname);
+}
+
+static bool _check(const char* name, bool ok)
+{
+  printf("%-40.40s  %s\n", name, ok ? "PASS" : "FAIL");
+  return ok;
+}
+
+//
+//  Write the configuration file of a test and return its path
+//
+static std::string _config(const char* name, const std::string& text)
+{
+  std::string path = std::string(_dir)+"/"+name+".input";
+  FILE* f = fopen(path.c_str(),"w");
+  if (f) {
+    fputs(text.c_str(), f);
+    fclose(f);
+  }
+  return path;
+}
+
+//
+//  Box step weights of 2*h samples (listed in the order of the
+//  configuration file)
+//
+static std::string _weights(unsigned h)
+{
+  std::string s("weights");
+  char buff[32];
+  for(unsigned i=0; i<2*h; i++) {
+    sprintf(buff," %g", (i<h ? 0.5:-0.5)/double(h));
+    s += buff;
+  }
+  return s+"\n";
+}
+
+//
+//  Synthetic frame: a spectrum on rows 400-600 with a smooth step of
+//  the transmission centred on column edge (signal shots only)
+//
+static void _frame(std::vector<uint16_t>& buf, bool signal, double edge)
+{
+  buf.resize(ROWS*COLS);
+  for(unsigned i=0; i<ROWS; i++)
+    for(unsigned j=0; j<COLS; j++) {
+      double s = (i>=400 && i<=600) ? 200.*exp(-0.5*pow((double(j)-512.)/250.,2)) : 0.;
+      if (signal)
+        s *= 0.85+0.15*tanh((double(j)-edge)/8.);
+      buf[i*COLS+j] = uint16_t(32.5+s);
+    }
+}
+
+//
+//  Synthetic frames with pixel noise and an edge moving across the
+//  spectrum; every fourth frame (and the first three) has no edge
+//
+static unsigned _seed = 1;
+
+static double _noise()
+{
+  _seed = _seed*1103515245+12345;
+  return double((_seed>>16)&0x7fff)/32768.-0.5;
+}
+
+static void _synthetic_frames(unsigned n)
+{
+  _frames.resize(n);
+  for(unsigned k=0; k<n; k++) {
+    std::vector<uint16_t>& buf = _frames[k];
+    bool   signal = k>2 && (k%4)!=0;
+    double edge   = 300.+400.*double(k)/double(n);
+    buf.resize(ROWS*COLS);
+    for(unsigned i=0; i<ROWS; i++)
+      for(unsigned j=0; j<COLS; j++) {
+        double s = (i>=400 && i<=600) ? 200.*exp(-0.5*pow((double(j)-512.)/250.,2)) : 0.;
+        if (signal)
+          s *= 0.85+0.15*tanh((double(j)-edge)/8.);
+        buf[i*COLS+j] = uint16_t(32.5+s+8.*_noise());
+      }
+  }
+}
+
+static bool _load_frames(const char* fname)
+{
+  FILE* f = fopen(fname,"r");
+  if (!f) {
+    perror(fname);
+    return false;
+  }
+  std::vector<uint16_t> buf(_rows*_cols);
+  while(fread(&buf[0], sizeof(uint16_t), buf.size(), f)==buf.size())
+    _frames.push_back(buf);
+  fclose(f);
+  printf("Loaded %zu frames from %s\n", _frames.size(), fname);
+  return _frames.size()>0;
+}
+
+//
+//  Analyse reference shots followed by a signal shot with the edge at
+//  column edge and return the edge position
+//
+static double _position(Fex& fex, double edge)
+{
+  std::vector<uint16_t> buf;
+  unsigned shape[2] = { ROWS, COLS };
+
+  Pds::EvrData::FIFOEvent fifo[2] = { Pds::EvrData::FIFOEvent(0,0,140),
+                                      Pds::EvrData::FIFOEvent(0,0,162) };
+  unsigned fs[1];
+
+  _frame(buf, false, edge);
+  fs[0] = 2;
+  for(unsigned i=0; i<3; i++) {
+    fex.reset();
+    fex.analyze(ndarray<const uint16_t,2>(&buf[0], shape),
+                ndarray<const Pds::EvrData::FIFOEvent,1>(fifo, fs), 0);
+  }
+
+  _frame(buf, true, edge);
+  fs[0] = 1;
+  fex.reset();
+  fex.analyze(ndarray<const uint16_t,2>(&buf[0], shape),
+              ndarray<const Pds::EvrData::FIFOEvent,1>(fifo, fs), 0);
+  return fex.filtered_position();
+}
+
+//
+//  An edge at a known column is found at the same position with and
+//  without binning along the projection
+//
+static bool test_binning()
+{
+  static const unsigned bins[] = { 1, 2, 4, 0 };
+  static const double   edges[] = { 517., 530.25, 0 };
+
+  bool ok = true;
+  for(const double* edge = edges; *edge; edge++) {
+    double pos[3];
+    for(unsigned k=0; bins[k]; k++) {
+      char buff[256];
+      sprintf(buff,
+              "project X\nsig_top 400\nsig_bot 600\n"
+              "spec_begin 20\nspec_end 1003\n"
+              "use_full_roi true\nfir_method direct\nbin_x %u\n",
+              bins[k]);
+      std::string path = _config("binning", std::string(buff)+_weights(40/bins[k]));
+      Fex fex(path.c_str(), false, false, _dir);
+      fex.configure();
+      pos[k] = _position(fex, *edge);
+      printf("  edge %g bin %u: position %f\n", *edge, bins[k], pos[k]);
+    }
+    for(unsigned k=1; bins[k]; k++)
+      if (!(fabs(pos[k]-pos[0]) < 0.25))
+        ok = false;
+  }
+  return _check("binned edge position", ok);
+}
+
+//
+//  The next amplitude is the second peak of the two-peak search whether
+//  or not the edge list suppresses it for its separation
+//
+static bool test_next_amplitude()
+{
+  std::vector<uint16_t> buf(ROWS*COLS);
+  unsigned shape[2] = { ROWS, COLS };
+  Pds::EvrData::FIFOEvent fifo[2] = { Pds::EvrData::FIFOEvent(0,0,140),
+                                      Pds::EvrData::FIFOEvent(0,0,162) };
+  unsigned fs[1];
+
+  double nxt[2];
+  for(unsigned k=0; k<2; k++) {
+    std::string path = _config("next",
+                               std::string("project X\nsig_top 400\nsig_bot 600\n"
+                                           "spec_begin 20\nspec_end 1003\n") +
+                               (k ? "num_edges 4\nedge_separation 40\n" : "") +
+                               _weights(4));
+    Fex fex(path.c_str(), false, false, _dir);
+    fex.configure();
+    for(unsigned ev=0; ev<4; ev++) {
+      bool signal = ev==3;
+      for(unsigned i=0; i<ROWS; i++)
+        for(unsigned j=0; j<COLS; j++) {
+          double s = (i>=400 && i<=600) ? 200. : 0.;
+          if (signal)
+            s *= 0.8+0.1*tanh((double(j)-500.)/2.)+0.05*tanh((double(j)-520.)/2.);
+          buf[i*COLS+j] = uint16_t(32.5+s);
+        }
+      fs[0] = signal ? 1:2;
+      fex.reset();
+      fex.analyze(ndarray<const uint16_t,2>(&buf[0], shape),
+                  ndarray<const Pds::EvrData::FIFOEvent,1>(fifo, fs), 0);
+    }
+    nxt[k] = fex.next_amplitude();
+    printf("  num_edges %u: next amplitude %f [%u edges]\n",
+           k ? 4:0, nxt[k], fex.nedges());
+  }
+  return _check("next amplitude with edge separation",
+                nxt[0] > 0 && nxt[1] == nxt[0]);
+}
+
+static bool _close(double a, double b, double tol)
+{
+  return fabs(a-b) <= tol;
+}
+
+//
+//  The sideband common mode, digital filter, peak search and parabolic
+//  fit agree with the psalg functions they replace on each frame
+//
+static bool test_psalg()
+{
+  unsigned sig_lo[2] = { _rows*2/5, 20 };
+  unsigned sig_hi[2] = { _rows*3/5, _cols-21 };
+  unsigned sb_lo [2] = { _rows/10 , 20 };
+  unsigned sb_hi [2] = { _rows/5  , _cols-21 };
+  unsigned shape [2] = { _rows, _cols };
+  unsigned n = sig_hi[1]-sig_lo[1]+1;
+
+  //
+  //  Asymmetric step weights (in the order of the filter) so that a
+  //  reversal would be seen
+  //
+  const unsigned nw = 80;
+  ndarray<double,1> w = make_ndarray<double>(nw);
+  for(unsigned i=0; i<nw; i++)
+    w[i] = (i<nw/2 ? 1.:-1.)*(1.+0.01*double(i))/double(nw);
+
+  Filter fft, direct;
+  fft   .configure(w.data(), nw, n, Filter::FFT);
+  direct.configure(w.data(), nw, n, Filter::Direct);
+
+  ndarray<double,1> sb_avg;
+  ndarray<double,2> sb_avg_full;
+  std::vector<double> cm(n), sigd(n), q(n), qf(n), cm_full, cm_means;
+
+  bool ok[6] = { true, true, true, true, true, true };
+  for(unsigned k=0; k<_frames.size(); k++) {
+    ndarray<const uint16_t,2> f(&_frames[k][0], shape);
+
+    ndarray<const int,1> sig = psalg::project(f, sig_lo, sig_hi, 32, 1);
+    ndarray<const int,1> sb  = psalg::project(f, sb_lo , sb_hi , 32, 1);
+    psalg::rolling_average(sb, sb_avg, 0.05);
+
+    //  Common mode of the projection and of the region
+    ndarray<const double,1> pcm = psalg::commonModeLROE(sb, sb_avg);
+    Filter::lroe(sb.data(), sb_avg.data(), n, &cm[0]);
+    for(unsigned i=0; i<n; i++)
+      if (!_close(cm[i], pcm[i], 1.e-9*(1.+fabs(pcm[i]))))
+        ok[0] = false;
+
+    ndarray<const int,2> sbr = psalg::roi(f, sb_lo, sb_hi, 32);
+    psalg::rolling_average(sbr, sb_avg_full, 0.05);
+    ndarray<const double,2> pcmf = psalg::commonModeLROE(sbr, sb_avg_full);
+    cm_full.resize(sbr.size());
+    Filter::lroe(sbr.data(), sb_avg_full.data(), sbr.shape()[0], sbr.shape()[1], &cm_full[0]);
+    for(unsigned i=0; i<sbr.size(); i++)
+      if (!_close(cm_full[i], pcmf.data()[i], 1.e-9*(1.+fabs(pcmf.data()[i]))))
+        ok[0] = false;
+
+    //  The row means expand to the same correction
+    cm_means.resize(4*sbr.shape()[0]);
+    Filter::lroe_means(sbr.data(), sb_avg_full.data(), sbr.shape()[0], sbr.shape()[1], &cm_means[0]);
+    Filter::lroe_expand(&cm_means[0], sbr.shape()[0], sbr.shape()[1], &cm_full[0]);
+    for(unsigned i=0; i<sbr.size(); i++)
+      if (!_close(cm_full[i], pcmf.data()[i], 1.e-9*(1.+fabs(pcmf.data()[i]))))
+        ok[0] = false;
+
+    //  Digital filter, directly and by each configured method
+    ndarray<double,1> s = make_ndarray<double>(n);
+    for(unsigned i=0; i<n; i++)
+      s[i] = sigd[i] = double(sig[i])-pcm[i];
+    ndarray<double,1> pq = psalg::finite_impulse_response(w, s);
+    unsigned imax, imax_fft, imax_dir;
+    unsigned nq = Filter::fir(w.data(), nw, &sigd[0], n, &q[0], imax);
+    double qmax = 0;
+    for(unsigned i=0; i<pq.size(); i++)
+      if (fabs(pq[i]) > qmax) qmax = fabs(pq[i]);
+    if (nq != pq.size())
+      ok[1] = false;
+    else {
+      for(unsigned i=0; i<nq; i++)
+        if (!_close(q[i], pq[i], 1.e-12*(1.+qmax)))
+          ok[1] = false;
+      if (direct.apply(&sigd[0], n, &qf[0], imax_dir) != nq || imax_dir != imax)
+        ok[1] = false;
+      for(unsigned i=0; i<nq; i++)
+        if (!_close(qf[i], pq[i], 1.e-12*(1.+qmax)))
+          ok[1] = false;
+      if (fft.apply(&sigd[0], n, &qf[0], imax_fft) != nq)
+        ok[2] = false;
+      for(unsigned i=0; i<nq; i++)
+        if (!_close(qf[i], pq[i], 1.e-9*(1.+qmax)))
+          ok[2] = false;
+    }
+
+    //  Peaks of the filter output
+    std::list<unsigned> ppk = psalg::find_peaks(pq, 0.5, 2);
+    unsigned pk[2];
+    unsigned npk = Filter::peaks(&q[0], nq, imax, 0.5, pk);
+    if (npk != ppk.size())
+      ok[3] = false;
+    else {
+      std::list<unsigned>::const_iterator it = ppk.begin();
+      for(unsigned i=0; i<npk; i++, ++it)
+        if (pk[i] != *it)
+          ok[3] = false;
+    }
+
+    //  Parabolic fit at each peak
+    for(std::list<unsigned>::const_iterator it = ppk.begin(); it != ppk.end(); ++it) {
+      ndarray<double,1> pfit = psalg::parab_fit(pq, *it, 0.8);
+      double fit[3];
+      Filter::parab_fit(&q[0], nq, *it, 0.8, fit);
+      for(unsigned i=0; i<3; i++)
+        if (!_close(fit[i], pfit[i], 1.e-6*(1.+fabs(pfit[i]))))
+          ok[4] = false;
+    }
+  }
+
+  bool result = true;
+  result &= _check("lroe vs psalg::commonModeLROE"         , ok[0]);
+  result &= _check("fir vs psalg::finite_impulse_response" , ok[1]);
+  result &= _check("fft vs psalg::finite_impulse_response" , ok[2]);
+  result &= _check("peaks vs psalg::find_peaks"            , ok[3]);
+  result &= _check("parab_fit vs psalg::parab_fit"         , ok[4]);
+  return result;
+}
+
+//
+//  Every supported kernel set projects and extracts ragged ROIs of each
+//  frame onto either axis exactly as psalg does: the same projection
+//  or region, sum and maximum
+//
+static bool test_isa()
+{
+  static const char* isas[] = { "scalar", "sse4", "avx2", "avx512", NULL };
+  static const unsigned nrows[] = { 1, 2, 3, 4, 5, 7, 9, 13, 0 };
+  static const unsigned ncols[] = { 1, 7, 8, 15, 16, 17, 31, 33, 63, 65, 100, 0 };
+  unsigned shape[2] = { _rows, _cols };
+  const unsigned ped = 32;
+  const unsigned nframes = _frames.size() < 4 ? _frames.size() : 4;
+
+  std::string dflt(Projector::isa());
+  std::vector<int> proj(_rows > _cols ? _rows : _cols), roi;
+
+  bool ok = true;
+  unsigned ncases = 0;
+  for(const char** isa = isas; *isa; isa++) {
+    if (!Projector::isa(*isa)) {
+      printf("  %s not supported\n", *isa);
+      continue;
+    }
+    for(unsigned k=0; k<nframes; k++) {
+      ndarray<const uint16_t,2> f(&_frames[k][0], shape);
+      for(const unsigned* nr = nrows; *nr; nr++)
+        for(const unsigned* nc = ncols; *nc; nc++) {
+          if (*nr > _rows || *nc > _cols)
+            continue;
+          //  offsets that vary the alignment of the first column
+          unsigned lo[2] = { (*nr*7+k)%(_rows-*nr+1), (*nc*3+*nr+k)%(_cols-*nc+1) };
+          unsigned hi[2] = { lo[0]+*nr-1, lo[1]+*nc-1 };
+          for(unsigned pdim=0; pdim<2; pdim++) {
+            ndarray<const int,1> p = psalg::project(f, lo, hi, ped, pdim);
+            double psum = 0;
+            int    pmax = p[0];
+            for(unsigned i=0; i<p.size(); i++) {
+              psum += p[i];
+              if (p[i] > pmax) pmax = p[i];
+            }
+            int vmax;
+            double sum = Projector::project(f, lo, hi, ped, pdim, &proj[0], vmax);
+            bool same = sum==psum && vmax==pmax;
+            for(unsigned i=0; i<p.size(); i++)
+              if (proj[i]!=p[i])
+                same = false;
+            if (!same) {
+              printf("  %s project pdim %u [%u,%u]x[%u,%u] frame %u differs\n",
+                     *isa, pdim, lo[0], hi[0], lo[1], hi[1], k);
+              ok = false;
+            }
+            ncases++;
+          }
+
+          ndarray<const int,2> r = psalg::roi(f, lo, hi, ped);
+          double rsum = 0;
+          int    rmax = r.data()[0];
+          for(unsigned i=0; i<r.size(); i++) {
+            rsum += r.data()[i];
+            if (r.data()[i] > rmax) rmax = r.data()[i];
+          }
+          roi.resize(r.size());
+          int vmax;
+          double sum = Projector::roi(f, lo, hi, ped, &roi[0], vmax);
+          bool same = sum==rsum && vmax==rmax &&
+            memcmp(&roi[0], r.data(), r.size()*sizeof(int))==0;
+          if (!same) {
+            printf("  %s roi [%u,%u]x[%u,%u] frame %u differs\n",
+                   *isa, lo[0], hi[0], lo[1], hi[1], k);
+            ok = false;
+          }
+          ncases++;
+        }
+    }
+  }
+  Projector::isa(dflt.c_str());
+  printf("  %u cases\n", ncases);
+  return _check("projection kernels vs psalg", ok);
+}
+
+//
+//  No workspace buffer is allocated once the first frame has been
+//  analysed, for each of the analysis paths
+//
+static bool test_allocations()
+{
+  static const char* paths[] = {
+    "",
+    "sb_top %u\nsb_bot %u\n",
+    "use_full_roi true\n",
+    "use_full_roi true\nsb_top %u\nsb_bot %u\n",
+    "num_edges 3\nedge_separation 20\n",
+    "use_float true\nfir_method direct\n",
+    "use_full_roi true\nuse_float true\nfir_method direct\n",
+    NULL };
+
+  unsigned shape[2] = { _rows, _cols };
+  Pds::EvrData::FIFOEvent fifo[2] = { Pds::EvrData::FIFOEvent(0,0,140),
+                                      Pds::EvrData::FIFOEvent(0,0,162) };
+  unsigned fs[1];
+
+  bool ok = true;
+  for(const char** path = paths; *path; path++) {
+    char buff[256], opts[128];
+    sprintf(opts, *path, _rows/10, _rows/10+_rows*3/5-_rows*2/5);
+    sprintf(buff,
+            "project X\nsig_top %u\nsig_bot %u\n"
+            "spec_begin 20\nspec_end %u\n%s",
+            _rows*2/5, _rows*3/5, _cols-21, opts);
+    std::string fname = _config("allocations", std::string(buff)+_weights(40));
+    Fex fex(fname.c_str(), false, false, _dir);
+    fex.configure();
+    unsigned first = 0;
+    for(unsigned k=0; k<_frames.size(); k++) {
+      fs[0] = (k<3 || (k%4)==0) ? 2:1;
+      fex.reset();
+      fex.analyze(ndarray<const uint16_t,2>(&_frames[k][0], shape),
+                  ndarray<const Pds::EvrData::FIFOEvent,1>(fifo, fs), 0);
+      if (k==0)
+        first = fex.allocations();
+      else if (fex.allocations() != first) {
+        printf("  [%s] %u allocations at frame %u\n",
+               opts, fex.allocations()-first, k);
+        ok = false;
+        break;
+      }
+    }
+  }
+  return _check("no allocations after the first frame", ok);
+}
+
+//
+//  A batch gives the results of the frames analysed one at a time,
+//  including the edge lists and the results of an ROI channel
+//
+static bool _same(const Fex& fex,
+                  const Fex::RoiResults& r,
+                  unsigned i)
+{
+  bool same =
+    r.position      [i] == fex.filtered_position() &&
+    r.position_ps   [i] == fex.filtered_pos_ps  () &&
+    r.fwhm          [i] == fex.filtered_fwhm    () &&
+    r.amplitude     [i] == fex.amplitude        () &&
+    r.next_amplitude[i] == fex.next_amplitude   () &&
+    r.ref_amplitude [i] == fex.ref_amplitude    () &&
+    r.sig_roi_sum   [i] == fex.sig_roi_sum      () &&
+    r.edge_index[i+1]-r.edge_index[i] == fex.nedges();
+  for(unsigned k=0; same && k<fex.nedges(); k++) {
+    const Fex::Edge& a = r.edges[r.edge_index[i]+k];
+    const Fex::Edge& b = fex.edge(k);
+    same = a.position==b.position && a.position_ps==b.position_ps &&
+      a.amplitude==b.amplitude && a.fwhm==b.fwhm;
+  }
+  return same;
+}
+
+static bool test_batch()
+{
+  char buff[256];
+  sprintf(buff,
+          "project X\nsig_top %u\nsig_bot %u\n"
+          "spec_begin 20\nspec_end %u\n",
+          _rows*3/10, _rows*7/10, _cols-21);
+  std::string channel = _config("channel", std::string(buff)+_weights(20));
+  sprintf(buff,
+          "project X\nsig_top %u\nsig_bot %u\n"
+          "spec_begin 20\nspec_end %u\n"
+          "num_edges 3\nedge_separation 20\nchannels %s\n",
+          _rows*2/5, _rows*3/5, _cols-21, channel.c_str());
+  std::string path = _config("batch", std::string(buff)+_weights(40));
+
+  unsigned n = _frames.size();
+  unsigned shape[2] = { _rows, _cols };
+  Pds::EvrData::FIFOEvent fifo[2] = { Pds::EvrData::FIFOEvent(0,0,140),
+                                      Pds::EvrData::FIFOEvent(0,0,162) };
+  unsigned fs[2] = { 1, 2 };
+  std::vector< ndarray<const uint16_t,2> > frames(n);
+  std::vector< ndarray<const Pds::EvrData::FIFOEvent,1> > evr(n);
+  for(unsigned k=0; k<n; k++) {
+    frames[k] = ndarray<const uint16_t,2>(&_frames[k][0], shape);
+    evr   [k] = ndarray<const Pds::EvrData::FIFOEvent,1>(fifo, (k<3 || (k%4)==0) ? &fs[1]:&fs[0]);
+  }
+
+  Fex batch(path.c_str(), false, false, _dir);
+  batch.configure();
+  Fex::BatchResults r;
+  batch.analyze_batch(&frames[0], &evr[0], NULL, n, r);
+
+  Fex fex(path.c_str(), false, false, _dir);
+  fex.configure();
+  bool ok = r.channels.size()==1;
+  unsigned nedges = 0, nchannel = 0;
+  for(unsigned k=0; ok && k<n; k++) {
+    fex.reset();
+    fex.analyze(frames[k], evr[k], 0);
+    nedges += fex.nedges();
+    if (fex.m_channels[0]->status())
+      nchannel++;
+    if (!_same(fex, r, k) || !_same(*fex.m_channels[0], r.channels[0], k)) {
+      printf("  frame %u differs\n", k);
+      ok = false;
+    }
+  }
+  printf("  %u frames, %u edges, %u channel edges\n", n, nedges, nchannel);
+  return _check("batch vs serial analysis", ok && nedges && nchannel);
+}
+
+//
+//  The single precision filter (use_float) finds the edge of each frame
+//  as the double precision filter does, within a tolerance of the
+//  position and the amplitude
+//
+static bool test_float()
+{
+  static const char* paths[] = {
+    "",
+    "sb_top %u\nsb_bot %u\n",
+    "use_full_roi true\n",
+    "use_full_roi true\nsb_top %u\nsb_bot %u\n",
+    NULL };
+  static const char* names[] = { "projected", "sideband", "full", "full sideband" };
+  const double ptol = 0.01;   // pixels
+  const double atol = 1.e-4;  // relative
+
+  unsigned shape[2] = { _rows, _cols };
+  Pds::EvrData::FIFOEvent fifo[2] = { Pds::EvrData::FIFOEvent(0,0,140),
+                                      Pds::EvrData::FIFOEvent(0,0,162) };
+  unsigned fs[1];
+
+  bool ok = true;
+  unsigned nedges = 0;
+  for(unsigned m=0; paths[m]; m++) {
+    char buff[256], opts[128];
+    sprintf(opts, paths[m], _rows/10, _rows/10+_rows*3/5-_rows*2/5);
+    sprintf(buff,
+            "project X\nsig_top %u\nsig_bot %u\n"
+            "spec_begin 20\nspec_end %u\nfir_method direct\n%s",
+            _rows*2/5, _rows*3/5, _cols-21, opts);
+    std::string fd = _config("double", std::string(buff)+_weights(40));
+    std::string ff = _config("float" , std::string(buff)+"use_float true\n"+_weights(40));
+    Fex fexd(fd.c_str(), false, false, _dir);
+    Fex fexf(ff.c_str(), false, false, _dir);
+    fexd.configure();
+    fexf.configure();
+    double dpos = 0, damp = 0;
+    unsigned nedge = 0;
+    for(unsigned k=0; k<_frames.size(); k++) {
+      fs[0] = (k<3 || (k%4)==0) ? 2:1;
+      ndarray<const uint16_t,2> frame(&_frames[k][0], shape);
+      ndarray<const Pds::EvrData::FIFOEvent,1> evr(fifo, fs);
+      fexd.reset();
+      fexf.reset();
+      fexd.analyze(frame, evr, 0);
+      fexf.analyze(frame, evr, 0);
+      if (fexd.status() != fexf.status()) {
+        printf("  [%s] edge found in %s precision only at frame %u\n",
+               names[m], fexd.status() ? "double":"single", k);
+        ok = false;
+        continue;
+      }
+      if (!fexd.status())
+        continue;
+      nedge++;
+      double d = fabs(fexf.filtered_position()-fexd.filtered_position());
+      double a = fabs(fexf.amplitude()/fexd.amplitude()-1.);
+      if (d > dpos) dpos = d;
+      if (a > damp) damp = a;
+    }
+    printf("  [%s] %u edges: |dpos| %g |damp| %g\n", names[m], nedge, dpos, damp);
+    if (!(_close(dpos, 0, ptol) && _close(damp, 0, atol)))
+      ok = false;
+    nedges += nedge;
+  }
+  return _check("float vs double edge", ok && nedges);
+}
+
+//
+//  A test throwing the configuration error of the timetool fails
+//
+static bool _run(bool (*test)())
+{
+  try {
+    return test();
+  } catch(std::string& e) {
+    printf("%s\n", e.c_str());
+    return false;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const char* fname = 0;
+  int c;
+  while ((c = getopt(argc, argv, "f:r:c:h")) != -1) {
+    switch (c) {
+    case 'f':
+      fname = optarg;
+      break;
+    case 'r':
+      _rows = strtoul(optarg,NULL,0);
+      break;
+    case 'c':
+      _cols = strtoul(optarg,NULL,0);
+      break;
+    case 'h':
+      usage(argv[0]);
+      exit(0);
+    default:
+      usage(argv[0]);
+      exit(2);
+    }
+  }
+
+  if (!mkdtemp(_dir)) {
+    perror("mkdtemp");
+    exit(2);
+  }
+
+  if (fname) {
+    if (!_load_frames(fname))
+      exit(2);
+  }
+  else
+    _synthetic_frames(32);
+
+  unsigned nfail = 0;
+  if (!_run(test_binning    )) nfail++;
+  if (!_run(test_next_amplitude)) nfail++;
+  if (!_run(test_psalg      )) nfail++;
+  if (!_run(test_isa        )) nfail++;
+  if (!_run(test_allocations)) nfail++;
+  if (!_run(test_batch      )) nfail++;
+  if (!_run(test_float      )) nfail++;
+
+  printf("%u tests failed\n", nfail);
+  return nfail;
+}
@@ -88,6 +88,84 @@ static void _insert_pv(InDatagram* dg,
   delete[] p;
 }
 
+//
+//  Names and values of the results of one ROI channel.  Each channel
+//  occupies a consecutive block of NPVS PV ids: the primary ROI has ids
+//  0..NPVS-1 and channel j (m_channels[j], configured as channel j+1)
+//  has ids NPVS*(j+1)..NPVS*(j+1)+NPVS-1, in the order AMPL, FLTPOS,
+//  FLTPOS_PS, FLTPOSFWHM, AMPLNXT, REFAMPL, SIGROISUM.
+//
+static const unsigned NPVS = 7;
+
+static void _insert_names(InDatagram* dg,
+                          const Src&  src,
+                          const ::TimeTool::Fex& fex,
+                          unsigned    base)
+{
+  _insert_pv(dg, src, base+0, fex.base_name()+":AMPL");
+  _insert_pv(dg, src, base+1, fex.base_name()+":FLTPOS");
+  _insert_pv(dg, src, base+2, fex.base_name()+":FLTPOS_PS");
+  _insert_pv(dg, src, base+3, fex.base_name()+":FLTPOSFWHM");
+  _insert_pv(dg, src, base+4, fex.base_name()+":AMPLNXT");
+  _insert_pv(dg, src, base+5, fex.base_name()+":REFAMPL");
+  _insert_pv(dg, src, base+6, fex.base_name()+":SIGROISUM");
+}
+
+static void _insert_values(InDatagram* dg,
+                           const Src&  src,
+                           const ::TimeTool::Fex& fex,
+                           unsigned    base)
+{
+  _insert_pv(dg, src, base+0, fex.amplitude());
+  _insert_pv(dg, src, base+1, fex.filtered_position ());
+  _insert_pv(dg, src, base+2, fex.filtered_pos_ps ());
+  _insert_pv(dg, src, base+3, fex.filtered_fwhm ());
+  _insert_pv(dg, src, base+4, fex.next_amplitude());
+  _insert_pv(dg, src, base+5, fex.ref_amplitude());
+  _insert_pv(dg, src, base+6, fex.sig_roi_sum());
+}
+
+//
+//  The edges of the multiple edge detector (num_edges) of each ROI
+//  follow the blocks of the ROIs, NEPVS ids per edge, for the primary
+//  ROI and then each channel, in the order FLTPOS, FLTPOS_PS, AMPL,
+//  FLTPOSFWHM.  Edges not found in an event are published as zero.
+//  Each returns the next free PV id.
+//
+static const unsigned NEPVS = 4;
+
+static unsigned _insert_edge_names(InDatagram* dg,
+                                   const Src&  src,
+                                   const ::TimeTool::Fex& fex,
+                                   unsigned    base)
+{
+  char buff[32];
+  for(unsigned k=0; k<fex.m_num_edges; k++, base+=NEPVS) {
+    sprintf(buff,":EDGE%u",k);
+    string name = fex.base_name()+buff;
+    _insert_pv(dg, src, base+0, name+":FLTPOS");
+    _insert_pv(dg, src, base+1, name+":FLTPOS_PS");
+    _insert_pv(dg, src, base+2, name+":AMPL");
+    _insert_pv(dg, src, base+3, name+":FLTPOSFWHM");
+  }
+  return base;
+}
+
+static unsigned _insert_edge_values(InDatagram* dg,
+                                    const Src&  src,
+                                    const ::TimeTool::Fex& fex,
+                                    unsigned    base)
+{
+  for(unsigned k=0; k<fex.m_num_edges; k++, base+=NEPVS) {
+    bool found = k<fex.nedges();
+    _insert_pv(dg, src, base+0, found ? fex.edge(k).position    : 0.);
+    _insert_pv(dg, src, base+1, found ? fex.edge(k).position_ps : 0.);
+    _insert_pv(dg, src, base+2, found ? fex.edge(k).amplitude   : 0.);
+    _insert_pv(dg, src, base+3, found ? fex.edge(k).fwhm        : 0.);
+  }
+  return base;
+}
+
 namespace Pds {
 
   //
@@ -100,6 +178,9 @@ namespace Pds {
   public:
     void _monitor_raw_sig (const ndarray<const double,1>&);
     void _monitor_ref_sig (const ndarray<const double,1>&);
+  private:
+    unsigned _ref_copied;  // shared reference generation last copied
+    unsigned _ref_local;   // local reference generation after the last copy
   };
     
   //
@@ -227,13 +308,13 @@ namespace Pds {
               //	  dg->datagram().xtc.extent = sizeof(Xtc);
 
               //  Insert the results
-              _insert_pv(dg, src, 0, fex.amplitude());
-              _insert_pv(dg, src, 1, fex.filtered_position ());
-              _insert_pv(dg, src, 2, fex.filtered_pos_ps ());
-              _insert_pv(dg, src, 3, fex.filtered_fwhm ());
-              _insert_pv(dg, src, 4, fex.next_amplitude());
-              _insert_pv(dg, src, 5, fex.ref_amplitude());
-              _insert_pv(dg, src, 6, fex.sig_roi_sum());
+              _insert_values(dg, src, fex, 0);
+              for(unsigned j=0; j<fex.m_channels.size(); j++)
+                _insert_values(dg, src, *fex.m_channels[j], NPVS*(j+1));
+              { unsigned id = NPVS*(fex.m_channels.size()+1);
+                id = _insert_edge_values(dg, src, fex, id);
+                for(unsigned j=0; j<fex.m_channels.size(); j++)
+                  id = _insert_edge_values(dg, src, *fex.m_channels[j], id); }
 
               break; 
             }
@@ -286,13 +367,15 @@ namespace Pds {
             InDatagram* dg = _dg;
             //const Src& src = fex.src();
             const Src& src = xtc->src;
-            _insert_pv(dg, src, 0, fex.base_name()+":AMPL");
-            _insert_pv(dg, src, 1, fex.base_name()+":FLTPOS");
-            _insert_pv(dg, src, 2, fex.base_name()+":FLTPOS_PS");
-            _insert_pv(dg, src, 3, fex.base_name()+":FLTPOSFWHM");
-            _insert_pv(dg, src, 4, fex.base_name()+":AMPLNXT");
-            _insert_pv(dg, src, 5, fex.base_name()+":REFAMPL");
-            _insert_pv(dg, src, 6, fex.base_name()+":SIGROISUM");
+            //  PV ids of channel j start at NPVS*(j+1), following the
+            //  block of the primary ROI
+            _insert_names(dg, src, fex, 0);
+            for(unsigned j=0; j<fex.m_channels.size(); j++)
+              _insert_names(dg, src, *fex.m_channels[j], NPVS*(j+1));
+            { unsigned id = NPVS*(fex.m_channels.size()+1);
+              id = _insert_edge_names(dg, src, fex, id);
+              for(unsigned j=0; j<fex.m_channels.size(); j++)
+                id = _insert_edge_names(dg, src, *fex.m_channels[j], id); }
             // create frame cache
             _frame[i] = ::TimeTool::FrameCache::instance(xtc->src, xtc->contains, xtc->payload());
           }
@@ -317,7 +400,9 @@ namespace Pds {
 
 
 Fex::Fex(const char* fname) :
-  ::TimeTool::Fex(fname)
+  ::TimeTool::Fex(fname),
+  _ref_copied(0),
+  _ref_local (0)
 {
 }
 
@@ -329,17 +414,28 @@ typedef std::map<Pds::Src,ndarray<double,1> > MapType;
 
 static MapType _ref;
 static Semaphore _sem(Semaphore::FULL);
+static volatile unsigned _ref_generation=0;  // incremented on each shared reference update
 
 //
 //  Ideally, each thread's 'm_ref' array would reference the
 //  same ndarray, but then I would need to control exclusive
-//  access during the reference updates
+//  access during the reference updates.  Instead each thread
+//  copies the shared reference, but only when it has been updated
+//  (or the local copy modified) since the last copy.
 //
 void Fex::_monitor_raw_sig (const ndarray<const double,1>&) 
 {
+  if (_ref_copied == _ref_generation && _ref_local == m_ref_gen)
+    return;
+  _sem.take();
   MapType::iterator it = _ref.find(_src);
-  if (it != _ref.end())
+  if (it != _ref.end()) {
     std::copy(it->second.begin(), it->second.end(), m_ref_avg.begin());
+    ref_changed();
+  }
+  _ref_copied = _ref_generation;
+  _ref_local  = m_ref_gen;
+  _sem.give();
 }
 
 void Fex::_monitor_ref_sig (const ndarray<const double,1>& ref) 
@@ -350,11 +446,13 @@ void Fex::_monitor_ref_sig (const ndarray<const double,1>& ref)
     std::copy(ref.begin(), ref.end(), a.begin());
     _sem.take();
     _ref[_src] = a;
+    _ref_generation++;
     _sem.give();
   }
   else {
     _sem.take();
     psalg::rolling_average(ref, it->second, m_ref_convergence);
+    _ref_generation++;
     _sem.give();
   }
 }
@@ -28,6 +28,7 @@
 
 #include "psalg/psalg.h"
 
+#include "timetool/service/Config.hh"
 #include "timetool/service/Fex.hh"
 #include "timetool/service/FrameCache.hh"
 
@@ -36,6 +37,7 @@
 #include <limits.h>
 #include <math.h>
 #include <stdlib.h>
+#include <time.h>
 #include <string>
 #include <new>
 #include <fstream>
@@ -67,6 +69,54 @@ static void copy_roi(ndarray<const int,2> in,
   std::copy(in.begin(),in.end(),a.begin());
 }
 
+//
+//  Overload policy.  Load is shed when more than shed_backlog events
+//  are queued to the work threads or the smoothed analysis latency
+//  exceeds shed_latency seconds.  Full processing resumes when the
+//  backlog has drained to resume_backlog events and the smoothed
+//  latency has fallen below resume_latency.  Events whose processing
+//  was reduced are flagged with degraded_damage in the user bits of
+//  the damage of their timetool data.  The levels are read from the
+//  timetool.input file of the default file path.
+//
+static int      _shed_backlog    = 4*NWORK_THREADS;
+static int      _resume_backlog  = NWORK_THREADS;
+static double   _shed_latency    = 0.05;
+static double   _resume_latency  = 0.025;
+static unsigned _degraded_damage = 0x1;
+
+static volatile int      _backlog  = 0;  // L1Accepts queued to or within the work threads
+static volatile unsigned _shedding = 0;  // load is shed
+static volatile double   _latency  = 0;  // smoothed analysis latency [sec]
+static unsigned          _reported = 0;  // overload state last reported
+
+static double _now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return double(ts.tv_sec)+1.e-9*double(ts.tv_nsec);
+}
+
+//
+//  Update the overload state after an event.  The latency is smoothed
+//  over about 16 events; the separate shed and resume levels keep the
+//  state from flapping.  Called from the work threads, so the change
+//  of state is reported from the dispatch thread.
+//
+static void _update_load(double latency)
+{
+  double lat = _latency;
+  lat += (latency-lat)*0.0625;
+  _latency = lat;
+
+  if (!_shedding) {
+    if (_backlog > _shed_backlog || lat > _shed_latency)
+      __sync_bool_compare_and_swap(&_shedding, 0, 1);
+  }
+  else if (_backlog <= _resume_backlog && lat < _resume_latency)
+    __sync_bool_compare_and_swap(&_shedding, 1, 0);
+}
+
 static void _insert_pv(InDatagram* dg,
                        const Src&  src,
                        int         id,
@@ -121,6 +171,8 @@ namespace Pds {
     void _monitor_ref_sig      (const ndarray<const double,1>&);
     void _monitor_raw_sig_full (const ndarray<const double,2>&);
     void _monitor_ref_sig_full (const ndarray<const double,2>&);
+    //  The shared full reference is synchronized from the full monitors
+    bool monitors_full() const { return true; }
     void _write_ref();
     void _enable_write_ref();
   public:
@@ -131,6 +183,9 @@ namespace Pds {
   private:
     char* _config_buffer;
     TimeToolDataType::EventType   _etype;
+    unsigned _ref_copied;       // shared reference generation last copied
+    unsigned _ref_full_copied;  // shared full reference generation last copied
+    unsigned _ref_local;        // local reference generation after the last copy
   };
     
   //
@@ -185,10 +240,14 @@ namespace Pds {
                                               dg->seq.stamp().vector(),
                                               v[i+1]);
 
+          bool   shed = _shedding;
+          double t0   = _now();
+
           for(unsigned i=0; i<_fex.size(); i++) {
             if (_frame[i] && !_frame[i]->empty()) {
               Fex& fex = *_fex[i];
               fex.reset();
+              fex.shed(shed);
               
               fex.m_pedestal = _frame[i]->offset();
               fex.analyze(_frame[i]->data(), fifo, 0);
@@ -232,12 +291,19 @@ namespace Pds {
                 }
                 Xtc xtc(_timetoolDataType,src);
                 xtc.extent += TimeToolDataType::_sizeof(fex.config());
+                if (fex.degraded()) {
+                  xtc.damage.increase(Damage::UserDefined);
+                  xtc.damage.userBits(_degraded_damage);
+                }
                 dg->insert(xtc, p);
                 delete[] p;
               }
             }
           }
 
+          _update_load(_now()-t0);
+          __sync_sub_and_fetch(&_backlog, 1);
+
           break; }
       case TransitionId::Configure:
         _dg = dg;
@@ -337,7 +403,10 @@ namespace Pds {
 Fex::Fex(const Src& src,
          const TimeToolConfigType& cfg) :
   ::TimeTool::Fex(src,cfg,false),
-  _config_buffer (new char[cfg._sizeof()])
+  _config_buffer (new char[cfg._sizeof()]),
+  _ref_copied    (0),
+  _ref_full_copied(0),
+  _ref_local     (0)
 {
   memcpy(_config_buffer, &cfg, cfg._sizeof());
 }
@@ -360,21 +429,31 @@ static bool _ref_written=false;
 static MapType _ref;
 static FullMapType _ref_full;
 static Semaphore _sem(Semaphore::FULL);
+static volatile unsigned _ref_generation=0;  // incremented on each shared reference update
 
 //
 //  Ideally, each thread's 'm_ref' array would reference the
 //  same ndarray, but then I would need to control exclusive
-//  access during the reference updates
+//  access during the reference updates.  Instead each thread
+//  copies the shared reference, but only when it has been updated
+//  (or the local copy modified) since the last copy.
 //
 void Fex::_monitor_raw_sig (const ndarray<const double,1>& a) 
 {
   _etype = TimeToolDataType::Signal;
+  if (_ref_copied == _ref_generation && _ref_local == m_ref_gen)
+    return;
+  _sem.take();
   MapType::iterator it = _ref.find(_src);
   if (it != _ref.end()) {
     if (m_ref_avg.size()!=it->second.size())
       m_ref_avg = make_ndarray<double>(it->second.size());
     std::copy(it->second.begin(), it->second.end(), m_ref_avg.begin());
+    ref_changed();
   }
+  _ref_copied = _ref_generation;
+  _ref_local  = m_ref_gen;
+  _sem.give();
 }
 
 void Fex::_monitor_ref_sig (const ndarray<const double,1>& ref) 
@@ -386,11 +465,13 @@ void Fex::_monitor_ref_sig (const ndarray<const double,1>& ref)
     std::copy(ref.begin(), ref.end(), a.begin());
     _sem.take();
     _ref[_src] = a;
+    _ref_generation++;
     _sem.give();
   }
   else {
     _sem.take();
     psalg::rolling_average(ref, it->second, m_ref_convergence);
+    _ref_generation++;
     _sem.give();
   }
 }
@@ -398,12 +479,19 @@ void Fex::_monitor_ref_sig (const ndarray<const double,1>& ref)
 void Fex::_monitor_raw_sig_full (const ndarray<const double,2>& a)
 {
   _etype = TimeToolDataType::Signal;
+  if (_ref_full_copied == _ref_generation && _ref_local == m_ref_gen)
+    return;
+  _sem.take();
   FullMapType::iterator it = _ref_full.find(_src);
   if (it != _ref_full.end()) {
     if (m_ref_avg_full.size()!=it->second.size())
       m_ref_avg_full = make_ndarray<double>(it->second.shape()[0],it->second.shape()[1]);
     std::copy(it->second.begin(), it->second.end(), m_ref_avg_full.begin());
+    ref_changed();
   }
+  _ref_full_copied = _ref_generation;
+  _ref_local       = m_ref_gen;
+  _sem.give();
 }
 
 void Fex::_monitor_ref_sig_full (const ndarray<const double,2>& ref)
@@ -415,11 +503,13 @@ void Fex::_monitor_ref_sig_full (const ndarray<const double,2>& ref)
     std::copy(ref.begin(), ref.end(), a.begin());
     _sem.take();
     _ref_full[_src] = a;
+    _ref_generation++;
     _sem.give();
   }
   else {
     _sem.take();
     psalg::rolling_average(ref, it->second, m_ref_convergence);
+    _ref_generation++;
     _sem.give();
   }
 }
@@ -487,6 +577,15 @@ TimeToolC::TimeToolC() :
   _pool      (sizeof(UserMessage),2)
 {
   (new TimeToolEpics)->connect(this);
+
+  char buff[PATH_MAX];
+  sprintf(buff,"%s/timetool.input", ::TimeTool::default_file_path());
+  ::TimeTool::Config svc(buff);
+  _shed_backlog    = svc.config("shed_backlog"   ,_shed_backlog);
+  _resume_backlog  = svc.config("resume_backlog" ,_resume_backlog);
+  _shed_latency    = svc.config("shed_latency"   ,_shed_latency);
+  _resume_latency  = svc.config("resume_latency" ,_resume_latency);
+  _degraded_damage = svc.config("degraded_damage",_degraded_damage);
 }
 
 TimeToolC::~TimeToolC()
@@ -516,6 +615,17 @@ InDatagram* TimeToolC::events(InDatagram* dg)
   switch (dg->datagram().seq.service()) {
   case TransitionId::L1Accept: 
     {
+      __sync_add_and_fetch(&_backlog, 1);
+
+      if (_shedding != _reported) {
+        _reported = _shedding;
+        if (_reported)
+          printf("TimeTool: shedding load [backlog %d, latency %f s]\n",
+                 _backlog, _latency);
+        else
+          printf("TimeTool: resuming full processing\n");
+      }
+
       //
       //  Encode the EVR FIFO onto the tail of this datagram
       //
@@ -138,6 +138,7 @@ template unsigned Config::config<unsigned>(const std::string& name, const unsign
 template double Config::config<double>(const std::string& name, const double& def);
 template std::string Config::config<std::string>(const std::string& name, const std::string& def);
 template std::vector<double> Config::config<double>(const std::string& name, const std::vector<double>& def);
+template std::vector<std::string> Config::config<std::string>(const std::string& name, const std::vector<std::string>& def);
 
 
 
@@ -1,13 +1,16 @@
 #include "Fex.hh"
 #include "Config.hh"
+#include "Filter.hh"
 #include "Fitter.hh"
+#include "Mask.hh"
+#include "Projector.hh"
+#include "Workspace.hh"
 
 #include "pdsdata/psddl/opal1k.ddl.h"
 #include "pdsdata/xtc/DetInfo.hh"
 #include "pdsdata/xtc/BldInfo.hh"
 #include "psalg/psalg.h"
 
-#include <list>
 #include <sstream>
 
 #include <stdlib.h>
@@ -52,13 +55,13 @@ static const char* cuts[] = {"NCalls",
                              "NoFits",
                              NULL };
 
-static ndarray<double,1> load_reference(unsigned key, unsigned sz, const char* dir);
+static ndarray<double,1> load_reference(const std::string& fname, unsigned sz);
 
-static ndarray<double,2> load_reference(unsigned key, unsigned row_sz, unsigned col_sz, const char* dir);
+static ndarray<double,2> load_reference(const std::string& fname, unsigned row_sz, unsigned col_sz);
 
-static double sum_array(const ndarray<const int,1>& data);
+static ndarray<double,2> load_dark(const std::string& fname, unsigned row_sz, unsigned col_sz);
 
-static double sum_array(const ndarray<const int,2>& data);
+static std::vector<std::string> load_mask(const std::string& fname);
 
 
 Fex::Fex(const char* fname,
@@ -67,8 +70,17 @@ Fex::Fex(const char* fname,
          const char* ref_path) :
   _fname(fname+strspn(fname," \t")),
   _ref_path(ref_path ? ref_path : default_file_path()),
+  m_channel(0),
+  m_build_channels(true),
   _write_ref_auto(write_ref_auto),
-  _fitter(new Fitter(verbose))
+  _fitter(new Fitter(verbose)),
+  _ws(new Workspace),
+  _fir(new Filter),
+  _fir_cmp(new Filter),
+  _fir_coarse(new Filter),
+  _sig_mask(new Mask),
+  _sb_mask (new Mask),
+  _ref_mask(new Mask)
 {
 }
 
@@ -78,8 +90,17 @@ Fex::Fex(const Pds::Src& src,
          bool verbose,
          const char* ref_path) :
   _ref_path(ref_path ? ref_path : default_file_path()),
+  m_channel(0),
+  m_build_channels(true),
   _write_ref_auto(write_ref_auto),
-  _fitter(new Fitter(verbose))
+  _fitter(new Fitter(verbose)),
+  _ws(new Workspace),
+  _fir(new Filter),
+  _fir_cmp(new Filter),
+  _fir_coarse(new Filter),
+  _sig_mask(new Mask),
+  _sb_mask (new Mask),
+  _ref_mask(new Mask)
 {
   //  m_put_key = std::string(cfg.base_name(),
   //                          cfg.base_name_length());
@@ -107,8 +128,25 @@ Fex::Fex(const Pds::Src& src,
 
   m_use_full_roi = false;
   m_use_fit = false;
+  m_fir_method = Filter::Auto;
+  m_use_float = false;
+  m_use_fixed = false;
+  m_fir_compare = false;
+  m_track_window = 0;
+  m_track_alpha = 0.5;
+  m_track_beta = 0.05;
+  m_track_min_amplitude = 0.5;
+  m_coarse_decimation = 0;
+  m_coarse_window = 64;
+  m_num_edges = 0;
+  m_edge_separation = 0;
+  m_adaptive_roi = false;
+  m_adaptive_roi_threshold = 0.1;
+  m_adaptive_roi_margin = 2;
+  m_use_dark = false;
 
   m_frame_roi[0] = m_frame_roi[1] = 0;
+  m_bin[0] = m_bin[1] = 1;
 
   m_sig_roi_lo[0] = cfg.sig_roi_lo().row();
   m_sig_roi_lo[1] = cfg.sig_roi_lo().column();
@@ -135,6 +173,7 @@ Fex::Fex(const Pds::Src& src,
 
   m_sb_convergence  = cfg.sb_convergence();
   m_ref_convergence = cfg.ref_convergence();
+  m_dark_convergence = 0.05;
 
   m_weights = make_ndarray<double>(cfg.number_of_weights());
   std::copy(cfg.weights().begin(), cfg.weights().end(), m_weights.data());
@@ -162,7 +201,7 @@ Fex::Fex(const Pds::Src& src,
 
   m_flt_offset = m_use_fit ? 0 : m_weights.size() / 2;
 
-  m_ref_avg = load_reference(m_get_key,sz,_ref_path.c_str());
+  m_ref_avg = load_reference(_file_name("ref"),sz);
   m_sig  = ndarray<const int,1>();
   m_sb   = ndarray<const int,1>();
   m_ref  = ndarray<const int,1>();
@@ -173,9 +212,14 @@ Fex::Fex(const Pds::Src& src,
   m_ref_full = ndarray<const int,2>();
 
   m_pedestal = 32;
+  m_channel_pedestal = -1;
+
+  m_mask = load_mask(_file_name("mask"));
 
   _cut.clear();
   _cut.resize(NCUTS,0);
+
+  _configure_workspace();
 }
 
 Fex::Fex(const Pds::Src& src,
@@ -184,8 +228,17 @@ Fex::Fex(const Pds::Src& src,
          bool verbose,
          const char* ref_path) :
   _ref_path(ref_path ? ref_path : default_file_path()),
+  m_channel(0),
+  m_build_channels(true),
   _write_ref_auto(write_ref_auto),
-  _fitter(new Fitter(verbose))
+  _fitter(new Fitter(verbose)),
+  _ws(new Workspace),
+  _fir(new Filter),
+  _fir_cmp(new Filter),
+  _fir_coarse(new Filter),
+  _sig_mask(new Mask),
+  _sb_mask (new Mask),
+  _ref_mask(new Mask)
 {
   //  m_put_key = std::string(cfg.base_name(),
   //                          cfg.base_name_length());
@@ -213,8 +266,25 @@ Fex::Fex(const Pds::Src& src,
 
   m_use_full_roi = false;
   m_use_fit = false;
+  m_fir_method = Filter::Auto;
+  m_use_float = false;
+  m_use_fixed = false;
+  m_fir_compare = false;
+  m_track_window = 0;
+  m_track_alpha = 0.5;
+  m_track_beta = 0.05;
+  m_track_min_amplitude = 0.5;
+  m_coarse_decimation = 0;
+  m_coarse_window = 64;
+  m_num_edges = 0;
+  m_edge_separation = 0;
+  m_adaptive_roi = false;
+  m_adaptive_roi_threshold = 0.1;
+  m_adaptive_roi_margin = 2;
+  m_use_dark = false;
 
   m_frame_roi[0] = m_frame_roi[1] = 0;
+  m_bin[0] = m_bin[1] = 1;
 
   m_sig_roi_lo[0] = cfg.sig_roi_lo().row();
   m_sig_roi_lo[1] = cfg.sig_roi_lo().column();
@@ -252,6 +322,7 @@ Fex::Fex(const Pds::Src& src,
 
   m_sb_convergence  = cfg.sb_convergence();
   m_ref_convergence = cfg.ref_convergence();
+  m_dark_convergence = 0.05;
 
   m_weights = make_ndarray<double>(cfg.number_of_weights());
   std::copy(cfg.weights().begin(), cfg.weights().end(), m_weights.data());
@@ -279,7 +350,7 @@ Fex::Fex(const Pds::Src& src,
 
   m_flt_offset = m_use_fit ? 0 : m_weights.size() / 2;
 
-  m_ref_avg = load_reference(m_get_key,sz,_ref_path.c_str());
+  m_ref_avg = load_reference(_file_name("ref"),sz);
   m_sig = ndarray<const int,1>();
   m_sb  = ndarray<const int,1>();
   m_ref = ndarray<const int,1>();
@@ -290,9 +361,14 @@ Fex::Fex(const Pds::Src& src,
   m_ref_full = ndarray<const int,2>();
 
   m_pedestal = 32;
+  m_channel_pedestal = -1;
+
+  m_mask = load_mask(_file_name("mask"));
 
   _cut.clear();
   _cut.resize(NCUTS,0);
+
+  _configure_workspace();
 }
 
 Fex::Fex(const Pds::Src& src,
@@ -301,8 +377,17 @@ Fex::Fex(const Pds::Src& src,
          bool verbose,
          const char* ref_path) :
   _ref_path(ref_path ? ref_path : default_file_path()),
+  m_channel(0),
+  m_build_channels(true),
   _write_ref_auto(write_ref_auto),
-  _fitter(new Fitter(verbose))
+  _fitter(new Fitter(verbose)),
+  _ws(new Workspace),
+  _fir(new Filter),
+  _fir_cmp(new Filter),
+  _fir_coarse(new Filter),
+  _sig_mask(new Mask),
+  _sb_mask (new Mask),
+  _ref_mask(new Mask)
 {
   //  m_put_key = std::string(cfg.base_name(),
   //                          cfg.base_name_length());
@@ -330,8 +415,25 @@ Fex::Fex(const Pds::Src& src,
 
   m_use_full_roi = cfg.use_full_roi();
   m_use_fit = cfg.use_fit();
+  m_fir_method = Filter::Auto;
+  m_use_float = false;
+  m_use_fixed = false;
+  m_fir_compare = false;
+  m_track_window = 0;
+  m_track_alpha = 0.5;
+  m_track_beta = 0.05;
+  m_track_min_amplitude = 0.5;
+  m_coarse_decimation = 0;
+  m_coarse_window = 64;
+  m_num_edges = 0;
+  m_edge_separation = 0;
+  m_adaptive_roi = false;
+  m_adaptive_roi_threshold = 0.1;
+  m_adaptive_roi_margin = 2;
+  m_use_dark = false;
 
   m_frame_roi[0] = m_frame_roi[1] = 0;
+  m_bin[0] = m_bin[1] = 1;
 
   m_sig_roi_lo[0] = cfg.sig_roi_lo().row();
   m_sig_roi_lo[1] = cfg.sig_roi_lo().column();
@@ -369,6 +471,7 @@ Fex::Fex(const Pds::Src& src,
 
   m_sb_convergence  = cfg.sb_convergence();
   m_ref_convergence = cfg.ref_convergence();
+  m_dark_convergence = 0.05;
 
   m_weights = make_ndarray<double>(cfg.number_of_weights());
   std::copy(cfg.weights().begin(), cfg.weights().end(), m_weights.data());
@@ -397,27 +500,39 @@ Fex::Fex(const Pds::Src& src,
 
   m_flt_offset = m_use_fit ? 0 : m_weights.size() / 2;
 
-  const char* dir = _ref_path.c_str();
-
-  m_ref_avg = m_use_full_roi ? ndarray<double,1>() : load_reference(m_get_key,sz,dir);
+  m_ref_avg = m_use_full_roi ? ndarray<double,1>() : load_reference(_file_name("ref"),sz);
   m_sig = ndarray<const int,1>();
   m_sb  = ndarray<const int,1>();
   m_ref = ndarray<const int,1>();
 
-  m_ref_avg_full = m_use_full_roi ? load_reference(m_get_key,row_sz,col_sz,dir) : ndarray<double,2>();
+  m_ref_avg_full = m_use_full_roi ? load_reference(_file_name("ref"),row_sz,col_sz) : ndarray<double,2>();
   m_sig_full = ndarray<const int,2>();
   m_sb_full  = ndarray<const int,2>();
   m_ref_full = ndarray<const int,2>();
 
   m_pedestal = 32;
+  m_channel_pedestal = -1;
+
+  m_mask = load_mask(_file_name("mask"));
 
   _cut.clear();
   _cut.resize(NCUTS,0);
+
+  _configure_workspace();
 }
 
 Fex::~Fex()
 {
   unconfigure();
+  for(unsigned i=0; i<m_channels.size(); i++)
+    delete m_channels[i];
+  delete _ws;
+  delete _fir;
+  delete _fir_cmp;
+  delete _fir_coarse;
+  delete _sig_mask;
+  delete _sb_mask;
+  delete _ref_mask;
 }
 
 void Fex::init_plots()
@@ -430,10 +545,9 @@ void Fex::init_plots()
 void Fex::unconfigure()
 {
   // Record accumulated reference if auto writing of references is enabled
-  char buff[PATH_MAX];
   if (_write_ref_auto) {
-    sprintf(buff,"%s/timetool.ref.%08x_bad", _ref_path.c_str(), m_get_key);
-    FILE* f = fopen(buff,"w");
+    std::string fname = _file_name("ref")+"_bad";
+    FILE* f = fopen(fname.c_str(),"w");
     if (f) {
       if (m_use_full_roi) {
         for(unsigned i=0; i<m_ref_avg_full.shape()[0]; i++)
@@ -448,13 +562,42 @@ void Fex::unconfigure()
     }
   }
 
+  // Record the learned pedestal map next to the reference
+  if (_write_ref_auto && m_dark_avg.size()) {
+    std::string fname = _file_name("dark")+"_bad";
+    FILE* f = fopen(fname.c_str(),"w");
+    if (f) {
+      for(unsigned i=0; i<m_dark_avg.shape()[0]; i++)
+        for(unsigned j=0; j<m_dark_avg.shape()[1]; j++)
+          fprintf(f," %f",m_dark_avg(i,j));
+      fprintf(f,"\n");
+      fclose(f);
+    }
+  }
+
+  for(unsigned i=0; i<m_channels.size(); i++)
+    m_channels[i]->unconfigure();
+
   if (_cut[NCALLS]>0) {
-    printf("TimeTool::Fex Summary\n");
+    if (m_channel)
+      printf("TimeTool::Fex Summary [channel %u]\n", m_channel);
+    else
+      printf("TimeTool::Fex Summary\n");
     for(unsigned i=0; i<NCUTS; i++)
       printf("%s: %3.2f [%u]\n",
              cuts[i],
              double(_cut[i])/double(_cut[NCALLS]),
              _cut[i]);
+    printf("Allocations: %u\n", _ws->allocations());
+    if (m_track_window)
+      printf("Tracked: %u  Fallbacks: %u\n", _trk_hits, _trk_misses);
+    if (m_coarse_decimation>1)
+      printf("Coarse: %u  Fallbacks: %u\n", _crs_hits, _crs_misses);
+    if (m_adaptive_roi)
+      printf("Adaptive ROI: %u changes\n", _roi_changes);
+    if (m_fir_compare && _cmp_n)
+      printf("FIR vs double: max |dpos| %g  rms %g [%u] pixels\n",
+             _cmp_max, sqrt(_cmp_sum2/double(_cmp_n)), _cmp_n);
   }
 }
 
@@ -534,6 +677,7 @@ void Fex::configure()
   m_proj_cut        = svc.config("proj_cut",m_proj_cut);
 
   m_frame_roi[0] = m_frame_roi[1] = 0;
+  m_bin[0] = m_bin[1] = 1;
 
   std::vector<unsigned> sig_roi_x(2);
   std::vector<unsigned> sig_roi_y(2);
@@ -610,7 +754,7 @@ void Fex::configure()
     std::vector<double> w = svc.config("weights",std::vector<double>());
     m_weights = make_ndarray<double>(w.size());
     //  Reverse the ordering of the weights for the
-    //  psalg::finite_impulse_response implementation
+    //  Filter::fir implementation
     for(unsigned i=0; i<w.size(); i++)
       m_weights[i] = w[w.size()-i-1];
   }
@@ -630,8 +774,48 @@ void Fex::configure()
   m_use_full_roi = svc.config("use_full_roi",false);
   m_use_fit  = svc.config("use_fit",false);
 
-  unsigned col_sz = m_sig_roi_hi[1]-m_sig_roi_lo[1]+1;
-  unsigned row_sz = m_sig_roi_hi[0]-m_sig_roi_lo[0]+1;
+  m_bin[0] = svc.config("bin_y",1);
+  m_bin[1] = svc.config("bin_x",1);
+  if (m_bin[0]<1) m_bin[0]=1;
+  if (m_bin[1]<1) m_bin[1]=1;
+  if (!m_use_full_roi && (m_bin[0]>1 || m_bin[1]>1)) {
+    printf("TimeTool: Binning applies to the full roi only.  Ignoring bin_x, bin_y.\n");
+    m_bin[0] = m_bin[1] = 1;
+  }
+
+  {
+    std::string a = svc.config("fir_method",std::string("auto"));
+    m_fir_method = (a[0]=='d' || a[0]=='D') ? Filter::Direct :
+                   (a[0]=='f' || a[0]=='F') ? Filter::FFT : Filter::Auto;
+  }
+  m_use_float = svc.config("use_float",false);
+  m_use_fixed   = svc.config("use_fixed",false);
+  m_fir_compare = svc.config("fir_compare",false);
+
+  m_track_window        = svc.config("track_window",0);
+  m_track_alpha         = svc.config("track_alpha",0.5);
+  m_track_beta          = svc.config("track_beta",0.05);
+  m_track_min_amplitude = svc.config("track_min_amplitude",0.5);
+
+  m_coarse_decimation   = svc.config("coarse_decimation",0);
+  m_coarse_window       = svc.config("coarse_window",64);
+
+  m_num_edges           = svc.config("num_edges",0);
+  m_edge_separation     = svc.config("edge_separation",0);
+
+  m_adaptive_roi           = svc.config("adaptive_roi",false);
+  m_adaptive_roi_threshold = svc.config("adaptive_roi_threshold",0.1);
+  m_adaptive_roi_margin    = svc.config("adaptive_roi_margin",2);
+  if (m_adaptive_roi && m_use_full_roi) {
+    printf("TimeTool: The adaptive roi applies to projected rois only.  Ignoring adaptive_roi.\n");
+    m_adaptive_roi = false;
+  }
+
+  m_use_dark         = svc.config("use_dark",false);
+  m_dark_convergence = svc.config("dark_convergence",0.05);
+
+  unsigned col_sz = _binned(m_sig_roi_lo, m_sig_roi_hi, 1);
+  unsigned row_sz = _binned(m_sig_roi_lo, m_sig_roi_hi, 0);
   unsigned sz = m_projectX ? col_sz : row_sz;
 
   if (m_use_fit)
@@ -644,23 +828,63 @@ void Fex::configure()
 
   m_flt_offset = m_use_fit ? 0 : m_weights.size() / 2;
 
-  const char* dir = _ref_path.c_str();
-
-  m_ref_avg = m_use_full_roi ? ndarray<double,1>() : load_reference(m_get_key,sz,dir);
+  m_ref_avg = m_use_full_roi ? ndarray<double,1>() : load_reference(_file_name("ref"),sz);
   m_sig = ndarray<const int,1>();
   m_sb  = ndarray<const int,1>();
   m_ref = ndarray<const int,1>();
 
-  m_ref_avg_full = m_use_full_roi ? load_reference(m_get_key,row_sz,col_sz,dir) : ndarray<double,2>();
+  m_ref_avg_full = m_use_full_roi ? load_reference(_file_name("ref"),row_sz,col_sz) : ndarray<double,2>();
   m_sig_full = ndarray<const int,2>();
   m_sb_full  = ndarray<const int,2>();
   m_ref_full = ndarray<const int,2>();
 
   m_pedestal = 32;
+  m_channel_pedestal = svc.config("pedestal",-1);
+
+  m_mask = load_mask(_file_name("mask"));
+
+  _dark_region();
+  m_dark_avg = m_use_dark ?
+    load_dark(_file_name("dark"),
+              m_dark_hi[0]-m_dark_lo[0]+1,
+              m_dark_hi[1]-m_dark_lo[1]+1) : ndarray<double,2>();
 
   _cut.clear();
   _cut.resize(NCUTS,0);
 
+  //
+  //  Further ROIs of the same camera, each configured from its own file,
+  //  are analysed in the same frame pass with this event logic
+  //
+  for(unsigned i=0; i<m_channels.size(); i++)
+    delete m_channels[i];
+  m_channels.clear();
+
+  m_channel_files = m_channel==0 ?
+    svc.config("channels",std::vector<std::string>()) : std::vector<std::string>();
+
+  if (m_build_channels) {
+    const std::vector<std::string>& files = m_channel_files;
+    for(unsigned i=0; i<files.size(); i++) {
+      Fex* c = new Fex(files[i].c_str(), _write_ref_auto, false, _ref_path.c_str());
+      c->m_channel = i+1;
+      c->m_get_key = m_get_key;
+      c->_src      = _src;
+      m_channels.push_back(c);
+      try {
+        c->configure();
+      } catch(std::string& e) {
+        s_exc += e;
+      }
+      if (m_use_full_roi || c->m_use_full_roi)
+        s_exc += std::string("TimeTool: ROI channels require projected ROIs.");
+      if (c->m_projectX != m_projectX)
+        s_exc += std::string("TimeTool: ROI channels must share the projection axis.");
+    }
+  }
+
+  _configure_workspace();
+
   if (!s_exc.empty())
     throw s_exc;
 }
@@ -668,7 +892,11 @@ void Fex::configure()
 const TimeToolConfigType* Fex::config(const char* fname)
 {
   Fex fex(fname);
+  fex.m_build_channels = false;
   fex.configure();
+  //  The DAQ configuration carries only the primary ROI
+  if (fex.m_channel_files.size())
+    throw std::string("TimeTool: ROI channels are not supported by the DAQ configuration.");
   fex.m_put_key.reserve(fex.m_put_key.size()+1);
   TimeToolConfigType tmplate(fex.m_beam_logic.size(),
                              fex.m_laser_logic.size(),
@@ -718,6 +946,11 @@ const TimeToolConfigType* Fex::config(const char* fname)
 
 void Fex::reset()
 {
+  for(unsigned i=0; i<m_channels.size(); i++)
+    m_channels[i]->reset();
+
+  _ws->reset_working_set();
+
   _flt_position  = 0;
   _flt_position_ps = 0;
   _flt_fwhm      = 0;
@@ -725,6 +958,512 @@ void Fex::reset()
   _ref_amplitude = 0;
   _nxt_amplitude = -1;
   _sig_roi_sum   = 0;
+  _nedges        = 0;
+  _degraded      = false;
+}
+
+void Fex::_configure_workspace()
+{
+  //
+  //  Size the per-event buffers from the ROI geometry
+  //
+  unsigned rows = _binned(m_sig_roi_lo, m_sig_roi_hi, 0);
+  unsigned cols = _binned(m_sig_roi_lo, m_sig_roi_hi, 1);
+  unsigned sz   = m_projectX ? cols : rows;
+
+  if (m_use_full_roi) {
+    _ws->i2(Workspace::SigRaw , rows, cols);
+    _ws->d2(Workspace::SigCorr, rows, cols);
+    _ws->d2(Workspace::RefCorr, rows, cols);
+    _ws->d1(Workspace::SigProj, sz);
+    _ws->d1(Workspace::SubProj, sz);
+    _ws->d1(Workspace::RefProj, sz);
+    if (m_use_sb_roi) {
+      _ws->i2(Workspace::SbRaw , _binned(m_sb_roi_lo, m_sb_roi_hi, 0), _binned(m_sb_roi_lo, m_sb_roi_hi, 1));
+      _ws->d2(Workspace::SbCorr, _binned(m_sb_roi_lo, m_sb_roi_hi, 0), _binned(m_sb_roi_lo, m_sb_roi_hi, 1));
+      _ws->d2(Workspace::SbMeans, _binned(m_sb_roi_lo, m_sb_roi_hi, 0), 4);
+    }
+    if (m_use_ref_roi)
+      _ws->i2(Workspace::RefRaw , rows, cols);
+  }
+  else {
+    _ws->i1(Workspace::SigRaw , sz);
+    _ws->d1(Workspace::SigCorr, sz);
+    _ws->d1(Workspace::RefCorr, sz);
+    if (m_use_sb_roi) {
+      _ws->i1(Workspace::SbRaw , sz);
+      _ws->d1(Workspace::SbCorr, sz);
+    }
+    if (m_use_ref_roi)
+      _ws->i1(Workspace::RefRaw , sz);
+  }
+
+  if (m_use_fit) {
+    _ws->d1(Workspace::FitParams, Fitter::nparams);
+    _ws->d1(Workspace::FitErrors, Fitter::nparams);
+    _ws->d1(Workspace::FitModel , sz);
+  }
+
+  //
+  //  The FIR also serves a fit configuration with weights while load
+  //  is shed; its output has a buffer of its own so that switching
+  //  does not reallocate
+  //
+  if (!m_use_fit || m_weights.size()) {
+    _fir->configure(m_weights.data(), m_weights.size(), sz,
+                    Filter::Method(m_fir_method),
+                    m_use_fixed ? Filter::Fixed :
+                    m_use_float ? Filter::Single : Filter::Double);
+    if (_single()) {
+      _ws->f1(Workspace::SigProjF , sz);
+      _ws->f1(Workspace::FilteredF, m_weights.size() > sz ? 0 : sz-m_weights.size()+1);
+      if (m_fir_compare)
+        _ws->d1(Workspace::SigProjCmp, sz);
+    }
+    else
+      _ws->d1(Workspace::Filtered , m_weights.size() > sz ? 0 : sz-m_weights.size()+1);
+    if (m_fir_compare) {
+      _ws->d1(Workspace::FilteredCmp, m_weights.size() > sz ? 0 : sz-m_weights.size()+1);
+      _fir_cmp->configure(m_weights.data(), m_weights.size(), sz,
+                          Filter::Method(m_fir_method), Filter::Double);
+    }
+    //
+    //  The coarse filter correlates the decimated signal with the
+    //  decimated weights
+    //
+    unsigned d = m_coarse_decimation;
+    if (d>1 && m_weights.size() >= 2*d && sz >= m_weights.size()) {
+      std::vector<double> w(m_weights.size()/d);
+      Filter::decimate(m_weights.data(), m_weights.size(), d, &w[0]);
+      _fir_coarse->configure(&w[0], w.size(), sz/d,
+                             Filter::Method(m_fir_method), Filter::Double);
+      _crs_nweights = w.size();
+      _ws->d1(Workspace::Coarse, sz/d);
+      _ws->d1(Workspace::CoarseFiltered, sz/d-_crs_nweights+1);
+    }
+    else
+      _crs_nweights = 0;
+  }
+  else
+    _crs_nweights = 0;
+  _cmp_n    = 0;
+  _cmp_sum2 = 0;
+  _cmp_max  = 0;
+
+  _trk_valid  = false;
+  _trk_hits   = 0;
+  _trk_misses = 0;
+
+  _crs_hits   = 0;
+  _crs_misses = 0;
+
+  //
+  //  Storage of the multiple edge detector
+  //
+  _edge_peaks.resize(m_num_edges > 2 ? m_num_edges : 2);
+  _edges     .resize(m_num_edges);
+  _nedges     = 0;
+  _degraded   = false;
+
+  //
+  //  The adaptive ROI starts from the configured ROI
+  //
+  if (m_adaptive_roi) {
+    unsigned cdim = m_projectX ? 0:1;
+    _roi_outer[0] = m_sig_roi_lo[cdim];
+    _roi_outer[1] = m_sig_roi_hi[cdim];
+    _sb_outer [0] = m_sb_roi_lo [cdim];
+    _sb_outer [1] = m_sb_roi_hi [cdim];
+    _ws->i1(Workspace::Profile, _roi_outer[1]-_roi_outer[0]+1);
+  }
+  _roi_profile = ndarray<double,1>();
+  _roi_changes = 0;
+
+  //
+  //  The reference was (re)loaded; its reciprocal is stale
+  //
+  m_ref_gen         = 1;
+  _ref_inv_gen      = 0;
+  _ref_inv_full_gen = 0;
+  _ref_proj_gen     = 0;
+  if (m_use_full_roi) {
+    _ws->d2(Workspace::RefInv , rows, cols);
+    _ws->d1(Workspace::RefAvgProj, sz);
+  }
+  else
+    _ws->d1(Workspace::RefInv, sz);
+
+  //
+  //  The pedestals of the ROIs are derived from the (re)loaded map
+  //
+  _dark_region();
+  m_dark_gen   = 1;
+  _dark_ws_gen = 0;
+  if (m_use_dark) {
+    if (m_use_full_roi) {
+      _ws->i2(Workspace::DarkSig, rows, cols);
+      if (m_use_sb_roi)
+        _ws->i2(Workspace::DarkSb, _binned(m_sb_roi_lo, m_sb_roi_hi, 0), _binned(m_sb_roi_lo, m_sb_roi_hi, 1));
+      if (m_use_ref_roi)
+        _ws->i2(Workspace::DarkRef, _binned(m_ref_roi_lo, m_ref_roi_hi, 0), _binned(m_ref_roi_lo, m_ref_roi_hi, 1));
+    }
+    else {
+      _ws->d1(Workspace::DarkSum, sz);
+      _ws->i1(Workspace::DarkSig, sz);
+      if (m_use_sb_roi)
+        _ws->i1(Workspace::DarkSb, sz);
+      if (m_use_ref_roi)
+        _ws->i1(Workspace::DarkRef, sz);
+    }
+  }
+
+  _compile_mask();
+
+  //
+  //  The ROIs have not been validated against a frame
+  //
+  _frame_shape[0] = _frame_shape[1] = 0;
+
+  _shed = false;
+  _select_pipelines();
+
+  //
+  //  One region for each ROI of each channel
+  //
+  if (m_channels.size()) {
+    unsigned n = 0;
+    for(unsigned i=0; i<=m_channels.size(); i++) {
+      const Fex& c = i ? *m_channels[i-1] : *this;
+      n += 1 + (c.m_use_sb_roi ? 1:0) + (c.m_use_ref_roi ? 1:0);
+    }
+    _ws->regions(n);
+  }
+
+  _ws->reset_allocations();
+}
+
+//
+//  Select the frame pipeline for this configuration.  A fit is replaced
+//  by the FIR while load is shed, if weights are configured.
+//
+void Fex::_select_pipelines()
+{
+  bool fit = _fit();
+
+  static const FramePipeline pipelines[] = {
+    &Fex::_analyze_frame<false,false,false,false>,
+    &Fex::_analyze_frame<false,false,false,true >,
+    &Fex::_analyze_frame<false,false,true ,false>,
+    &Fex::_analyze_frame<false,false,true ,true >,
+    &Fex::_analyze_frame<false,true ,false,false>,
+    &Fex::_analyze_frame<false,true ,false,true >,
+    &Fex::_analyze_frame<false,true ,true ,false>,
+    &Fex::_analyze_frame<false,true ,true ,true >,
+    &Fex::_analyze_frame<true ,false,false,false>,
+    &Fex::_analyze_frame<true ,false,false,true >,
+    &Fex::_analyze_frame<true ,false,true ,false>,
+    &Fex::_analyze_frame<true ,false,true ,true >,
+    &Fex::_analyze_frame<true ,true ,false,false>,
+    &Fex::_analyze_frame<true ,true ,false,true >,
+    &Fex::_analyze_frame<true ,true ,true ,false>,
+    &Fex::_analyze_frame<true ,true ,true ,true > };
+  _frame_pipeline = pipelines[(m_use_full_roi ? 8:0) |
+                              (m_use_sb_roi   ? 4:0) |
+                              (m_use_ref_roi  ? 2:0) |
+                              (fit            ? 1:0)];
+
+  static const ChannelPipeline channel_pipelines[] = {
+    &Fex::_analyze_projected<false,false,false>,
+    &Fex::_analyze_projected<false,false,true >,
+    &Fex::_analyze_projected<false,true ,false>,
+    &Fex::_analyze_projected<false,true ,true >,
+    &Fex::_analyze_projected<true ,false,false>,
+    &Fex::_analyze_projected<true ,false,true >,
+    &Fex::_analyze_projected<true ,true ,false>,
+    &Fex::_analyze_projected<true ,true ,true > };
+  _channel_pipeline = channel_pipelines[(m_use_sb_roi  ? 4:0) |
+                                        (m_use_ref_roi ? 2:0) |
+                                        (fit           ? 1:0)];
+}
+
+//
+//  Overload policy of the application.  While load is shed an existing
+//  reference is not updated, and a fit configuration with weights finds
+//  the edge with the FIR (normalized with the FIR reference offset).
+//
+void Fex::shed(bool v)
+{
+  if (v == _shed)
+    return;
+  _shed = v;
+  _select_pipelines();
+  for(unsigned i=0; i<m_channels.size(); i++)
+    m_channels[i]->shed(v);
+}
+
+unsigned Fex::allocations() const
+{
+  unsigned n = _ws->allocations();
+  for(unsigned i=0; i<m_channels.size(); i++)
+    n += m_channels[i]->allocations();
+  return n;
+}
+
+unsigned long Fex::working_set() const
+{
+  unsigned long n = _ws->working_set();
+  for(unsigned i=0; i<m_channels.size(); i++)
+    n += m_channels[i]->working_set();
+  return n;
+}
+
+//
+//  Reference, pedestal and mask files of this ROI channel
+//
+std::string Fex::_file_name(const char* type) const
+{
+  char buff[PATH_MAX];
+  if (m_channel)
+    sprintf(buff,"%s/timetool.%s.%08x.%u", _ref_path.c_str(), type, m_get_key, m_channel);
+  else
+    sprintf(buff,"%s/timetool.%s.%08x", _ref_path.c_str(), type, m_get_key);
+  return std::string(buff);
+}
+
+//
+//  Element-wise reciprocal of the accumulated reference.  It is only
+//  recomputed when the reference generation has changed since the last
+//  call, so events between reference updates multiply instead of divide.
+//
+const ndarray<double,1>& Fex::_ref_reciprocal()
+{
+  ndarray<double,1>& r = _ws->d1(Workspace::RefInv, m_ref_avg.size());
+  if (_ref_inv_gen != m_ref_gen) {
+    for(unsigned i=0; i<m_ref_avg.size(); i++)
+      r[i] = 1./m_ref_avg[i];
+    _ref_inv_gen = m_ref_gen;
+  }
+  return r;
+}
+
+const ndarray<double,2>& Fex::_ref_reciprocal_full()
+{
+  ndarray<double,2>& r = _ws->d2(Workspace::RefInv,
+                                 m_ref_avg_full.shape()[0],
+                                 m_ref_avg_full.shape()[1]);
+  if (_ref_inv_full_gen != m_ref_gen) {
+    const double* a = m_ref_avg_full.data();
+    double*       p = r.data();
+    for(unsigned i=0; i<m_ref_avg_full.size(); i++)
+      p[i] = 1./a[i];
+    _ref_inv_full_gen = m_ref_gen;
+  }
+  return r;
+}
+
+//
+//  Projection of the accumulated full reference onto the signal axis,
+//  recomputed only when the reference has changed
+//
+const ndarray<double,1>& Fex::_ref_projected()
+{
+  unsigned pdim = m_projectX ? 1:0;
+  ndarray<double,1>& r = _ws->d1(Workspace::RefAvgProj, m_ref_avg_full.shape()[pdim]);
+  if (_ref_proj_gen != m_ref_gen) {
+    Projector::project(m_ref_avg_full.data(),
+                       m_ref_avg_full.shape()[0],
+                       m_ref_avg_full.shape()[1],
+                       pdim, r.data());
+    _ref_proj_gen = m_ref_gen;
+  }
+  return r;
+}
+
+//
+//  The pedestal map covers the bounding box of the ROIs in use
+//
+void Fex::_dark_region()
+{
+  for(unsigned i=0; i<2; i++) {
+    m_dark_lo[i] = m_sig_roi_lo[i];
+    m_dark_hi[i] = m_sig_roi_hi[i];
+    if (m_use_sb_roi) {
+      if (m_sb_roi_lo[i] < m_dark_lo[i]) m_dark_lo[i] = m_sb_roi_lo[i];
+      if (m_sb_roi_hi[i] > m_dark_hi[i]) m_dark_hi[i] = m_sb_roi_hi[i];
+    }
+    if (m_use_ref_roi) {
+      if (m_ref_roi_lo[i] < m_dark_lo[i]) m_dark_lo[i] = m_ref_roi_lo[i];
+      if (m_ref_roi_hi[i] > m_dark_hi[i]) m_dark_hi[i] = m_ref_roi_hi[i];
+    }
+  }
+}
+
+//
+//  Rolling average of the no-laser frames over the pedestal region
+//
+void Fex::_update_dark(const ndarray<const uint16_t,2>& f)
+{
+  unsigned rows = m_dark_hi[0]-m_dark_lo[0]+1;
+  unsigned cols = m_dark_hi[1]-m_dark_lo[1]+1;
+  if (m_dark_avg.size()==0) {
+    m_dark_avg = make_ndarray<double>(rows,cols);
+    for(unsigned i=0; i<rows; i++)
+      for(unsigned j=0; j<cols; j++)
+        m_dark_avg(i,j) = f(i+m_dark_lo[0],j+m_dark_lo[1]);
+  }
+  else {
+    double c = m_dark_convergence;
+    for(unsigned i=0; i<rows; i++) {
+      const uint16_t* p = &f(i+m_dark_lo[0],m_dark_lo[1]);
+      double*         a = &m_dark_avg(i,0);
+      for(unsigned j=0; j<cols; j++)
+        a[j] += c*(double(p[j])-a[j]);
+    }
+  }
+  m_dark_gen++;
+}
+
+//
+//  Pedestal map of a (binned) ROI, or its projection onto pdim, summed
+//  in double precision and rounded once per output element
+//
+static void _dark_roi(const ndarray<double,2>& d,
+                      const unsigned* dlo,
+                      const unsigned* lo,
+                      const unsigned* hi,
+                      const unsigned* bin,
+                      int* out)
+{
+  unsigned nrows = (hi[0]-lo[0]+1)/bin[0];
+  unsigned ncols = (hi[1]-lo[1]+1)/bin[1];
+  for(unsigned r=0; r<nrows; r++)
+    for(unsigned c=0; c<ncols; c++) {
+      double v = 0;
+      for(unsigned i=lo[0]+r*bin[0]; i<lo[0]+(r+1)*bin[0]; i++)
+        for(unsigned j=lo[1]+c*bin[1]; j<lo[1]+(c+1)*bin[1]; j++)
+          v += d(i-dlo[0],j-dlo[1]);
+      *out++ = int(lrint(v));
+    }
+}
+
+static void _dark_project(const ndarray<double,2>& d,
+                          const unsigned* dlo,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned pdim,
+                          const Mask& mask,
+                          double* sum,
+                          int* out)
+{
+  unsigned sz = hi[pdim]-lo[pdim]+1;
+  for(unsigned k=0; k<sz; k++)
+    sum[k] = 0;
+  const std::vector<Mask::Run>& runs = mask.runs();
+  for(unsigned k=0; k<runs.size(); k++) {
+    const Mask::Run& r = runs[k];
+    for(unsigned j=r.col; j<r.col+r.n; j++)
+      sum[pdim ? j : r.row] += d(lo[0]+r.row-dlo[0],lo[1]+j-dlo[1]);
+  }
+  for(unsigned k=0; k<sz; k++)
+    out[k] = int(lrint(sum[k]));
+}
+
+//
+//  Integer pedestals of the ROIs from the pedestal map, recomputed only
+//  when the map has changed.  Returns false if there is no map, in which
+//  case the scalar pedestal applies.
+//
+bool Fex::_dark_pedestal()
+{
+  if (m_dark_avg.size()==0)
+    return false;
+  if (_dark_ws_gen != m_dark_gen) {
+    if (m_use_full_roi) {
+      _dark_roi(m_dark_avg, m_dark_lo, m_sig_roi_lo, m_sig_roi_hi, m_bin,
+                _ws->i2(Workspace::DarkSig,
+                        _binned(m_sig_roi_lo, m_sig_roi_hi, 0),
+                        _binned(m_sig_roi_lo, m_sig_roi_hi, 1)).data());
+      if (m_use_sb_roi)
+        _dark_roi(m_dark_avg, m_dark_lo, m_sb_roi_lo, m_sb_roi_hi, m_bin,
+                  _ws->i2(Workspace::DarkSb,
+                          _binned(m_sb_roi_lo, m_sb_roi_hi, 0),
+                          _binned(m_sb_roi_lo, m_sb_roi_hi, 1)).data());
+      if (m_use_ref_roi)
+        _dark_roi(m_dark_avg, m_dark_lo, m_ref_roi_lo, m_ref_roi_hi, m_bin,
+                  _ws->i2(Workspace::DarkRef,
+                          _binned(m_ref_roi_lo, m_ref_roi_hi, 0),
+                          _binned(m_ref_roi_lo, m_ref_roi_hi, 1)).data());
+    }
+    else {
+      unsigned pdim = m_projectX ? 1:0;
+      unsigned sz   = m_sig_roi_hi[pdim]-m_sig_roi_lo[pdim]+1;
+      _dark_project(m_dark_avg, m_dark_lo, m_sig_roi_lo, m_sig_roi_hi, pdim,
+                    *_sig_mask, _ws->d1(Workspace::DarkSum, sz).data(),
+                    _ws->i1(Workspace::DarkSig, sz).data());
+      if (m_use_sb_roi)
+        _dark_project(m_dark_avg, m_dark_lo, m_sb_roi_lo, m_sb_roi_hi, pdim,
+                      *_sb_mask, _ws->d1(Workspace::DarkSum, sz).data(),
+                      _ws->i1(Workspace::DarkSb, sz).data());
+      if (m_use_ref_roi)
+        _dark_project(m_dark_avg, m_dark_lo, m_ref_roi_lo, m_ref_roi_hi, pdim,
+                      *_ref_mask, _ws->d1(Workspace::DarkSum, sz).data(),
+                      _ws->i1(Workspace::DarkRef, sz).data());
+    }
+    _dark_ws_gen = m_dark_gen;
+  }
+  return true;
+}
+
+//
+//  Compile the pixel mask into skip lists for the projected ROIs.  The
+//  full ROIs are normalized pixel by pixel and are not masked.
+//
+void Fex::_compile_mask()
+{
+  unsigned pdim = m_projectX ? 1:0;
+  std::vector<std::string> none;
+  const std::vector<std::string>& bitmap = m_use_full_roi ? none : m_mask;
+  _sig_mask->compile(bitmap, m_sig_roi_lo, m_sig_roi_hi, pdim);
+  _sb_mask ->compile(bitmap, m_sb_roi_lo , m_sb_roi_hi , pdim);
+  _ref_mask->compile(bitmap, m_ref_roi_lo, m_ref_roi_hi, pdim);
+}
+
+//
+//  Full ROI with the scalar pedestal or the pedestal map (if given),
+//  binned if configured
+//
+double Fex::_extract_roi(const ndarray<const uint16_t,2>& f,
+                         const unsigned* lo,
+                         const unsigned* hi,
+                         const int*      dark,
+                         int*            roi,
+                         int&            vmax)
+{
+  if (m_bin[0]>1 || m_bin[1]>1)
+    return Projector::roi(f, lo, hi, m_pedestal, dark, m_bin, roi, vmax);
+  if (dark)
+    return Projector::roi(f, lo, hi, dark, roi, vmax);
+  return Projector::roi(f, lo, hi, m_pedestal, roi, vmax);
+}
+
+//
+//  Projection of an ROI with the scalar pedestal or the projection of the
+//  pedestal map (if given), skipping masked pixels
+//
+double Fex::_project_roi(const ndarray<const uint16_t,2>& f,
+                         const unsigned* lo,
+                         const unsigned* hi,
+                         const Mask&     mask,
+                         const int*      dproj,
+                         int*            proj,
+                         int&            vmax)
+{
+  unsigned pdim = m_projectX ? 1:0;
+  if (!mask.empty())
+    return Projector::project(f, lo, hi, m_pedestal, dproj, pdim, mask, proj, vmax);
+  if (dproj)
+    return Projector::project(f, lo, hi, dproj, pdim, proj, vmax);
+  return Projector::project(f, lo, hi, m_pedestal, pdim, proj, vmax);
 }
 
 static bool _calculate_logic(const ndarray<const Pds::TimeTool::EventLogic,1>& cfg,
@@ -754,12 +1493,108 @@ static bool _calculate_logic(const ndarray<const Pds::TimeTool::EventLogic,1>& c
   return v;
 }
 
+//
+//  Workspace backed versions of the psalg helpers
+//
+static const ndarray<double,1>& _project(Workspace& ws,
+                                         Workspace::DoubleBuffer b,
+                                         const ndarray<const double,2>& a,
+                                         unsigned pdim)
+{
+  ndarray<double,1>& r = ws.d1(b, a.shape()[pdim]);
+  Projector::project(a.data(), a.shape()[0], a.shape()[1], pdim, r.data());
+  return r;
+}
+
+static const ndarray<double,1>& _project(Workspace&,
+                                         Workspace::DoubleBuffer,
+                                         const ndarray<double,1>& a,
+                                         unsigned)
+{
+  return a;
+}
+
+static void _divide_reference(double* s,
+                              const double* rinv,
+                              unsigned n,
+                              double offset)
+{
+  for(unsigned i=0; i<n; i++)
+    s[i] = s[i]*rinv[i] - offset;
+}
+
+static void _divide_reference(const double* s,
+                              const double* rinv,
+                              unsigned n,
+                              double offset,
+                              float* out)
+{
+  for(unsigned i=0; i<n; i++)
+    out[i] = float(s[i]*rinv[i] - offset);
+}
+
+//
+//  Filter output buffer of the precision of the signal
+//
+static ndarray<double,1>& _filtered(Workspace& ws, unsigned n, const double*)
+{
+  return ws.d1(Workspace::Filtered, n);
+}
+
+static ndarray<float,1>& _filtered(Workspace& ws, unsigned n, const float*)
+{
+  return ws.f1(Workspace::FilteredF, n);
+}
+
+static const ndarray<double,1>& _filter(Workspace& ws,
+                                        Filter& fir,
+                                        unsigned nw,
+                                        const ndarray<const double,1>& s,
+                                        unsigned& imax,
+                                        Workspace::DoubleBuffer b=Workspace::Filtered)
+{
+  unsigned n = nw > s.size() ? 0 : s.size()-nw+1;
+  ndarray<double,1>& r = ws.d1(b, n);
+  fir.apply(s.data(), s.size(), r.data(), imax);
+  return r;
+}
+
+static const ndarray<float,1>& _filter(Workspace& ws,
+                                       Filter& fir,
+                                       unsigned nw,
+                                       const ndarray<const float,1>& s,
+                                       unsigned& imax)
+{
+  unsigned n = nw > s.size() ? 0 : s.size()-nw+1;
+  ndarray<float,1>& r = ws.f1(Workspace::FilteredF, n);
+  fir.apply(s.data(), s.size(), r.data(), imax);
+  return r;
+}
+
+//
+//  Filter output over [lo,hi) only; the output outside is zero
+//
+template<class T>
+static const ndarray<T,1>& _filter_window(Workspace& ws,
+                                          Filter& fir,
+                                          unsigned nw,
+                                          const ndarray<const T,1>& s,
+                                          unsigned lo,
+                                          unsigned hi,
+                                          unsigned& imax)
+{
+  unsigned n = s.size()-nw+1;
+  ndarray<T,1>& r = _filtered(ws, n, s.data());
+  memset(r.data(), 0, n*sizeof(T));
+  fir.apply(s.data()+lo, hi-lo+nw-1, r.data()+lo, imax);
+  imax += lo;
+  return r;
+}
+
 void Fex::analyze(const ndarray<const uint16_t,2>& f,
                   const ndarray<const Pds::EvrData::FIFOEvent,1>& evr,
                   const Pds::Lusi::IpmFexV1* ipm)
 {
-  _cut[NCALLS]++;
-
   bool nobeam   = !_calculate_logic(m_beam_logic,
                                     evr);
   bool nolaser  = !_calculate_logic(m_laser_logic,
@@ -777,7 +1612,17 @@ void Fex::analyze(const ndarray<const uint16_t,2>& f,
          nobeam ? 'F':'T', nolaser ? 'F':'T');
 #endif
 
-  if (nolaser) { _cut[NOLASER]++; return; }
+  //
+  //  The event logic is evaluated once for all ROI channels
+  //
+  bool accept = _accept_frame(f, nolaser);
+  for(unsigned i=0; i<m_channels.size(); i++) {
+    Fex& c = *m_channels[i];
+    c.m_pedestal = c.m_channel_pedestal < 0 ? m_pedestal : unsigned(c.m_channel_pedestal);
+    c._accept_frame(f, nolaser);
+  }
+  if (!accept)
+    return;
 
   //
   //  Beam is absent if not enough signal on the IPM detector
@@ -785,7 +1630,144 @@ void Fex::analyze(const ndarray<const uint16_t,2>& f,
   if (ipm)
     nobeam |= ipm->sum() < m_ipm_beam_threshold;
 
-  if (!f.size()) { _cut[FRAMESIZE]++; return; }
+  if (nobeam) {
+    if (m_adaptive_roi)
+      _adapt_roi(f);
+    for(unsigned i=0; i<m_channels.size(); i++)
+      if (m_channels[i]->m_adaptive_roi)
+        m_channels[i]->_adapt_roi(f);
+  }
+
+  if (m_channels.empty())
+    (this->*_frame_pipeline)(f, nobeam);
+  else
+    _analyze_channels(f, nobeam);
+}
+
+static void _batch_size(Fex::RoiResults& r, unsigned n)
+{
+  r.position      .resize(n);
+  r.position_ps   .resize(n);
+  r.fwhm          .resize(n);
+  r.amplitude     .resize(n);
+  r.next_amplitude.resize(n);
+  r.ref_amplitude .resize(n);
+  r.sig_roi_sum   .resize(n);
+  r.cut           .resize(n);
+  r.edge_index    .resize(n+1);
+  r.edge_index[0] = 0;
+  r.edges         .clear();
+}
+
+void Fex::analyze_batch(const ndarray<const uint16_t,2>* frames,
+                        const ndarray<const Pds::EvrData::FIFOEvent,1>* evr_fifos,
+                        const Pds::Lusi::IpmFexV1* const* ipms,
+                        unsigned n,
+                        BatchResults& r)
+{
+  _batch_size(r, n);
+  r.channels.resize(m_channels.size());
+  for(unsigned j=0; j<m_channels.size(); j++)
+    _batch_size(r.channels[j], n);
+
+  //  summary counters of this Fex and of each channel before the frame
+  std::vector<unsigned> cut(NCUTS*(m_channels.size()+1));
+  for(unsigned i=0; i<n; i++) {
+    for(unsigned j=0; j<=m_channels.size(); j++) {
+      const Fex& c = j ? *m_channels[j-1] : *this;
+      std::copy(c._cut.begin(), c._cut.end(), &cut[NCUTS*j]);
+    }
+
+    reset();
+    analyze(frames[i], evr_fifos[i], ipms ? ipms[i] : 0);
+
+    _batch_result(r, i, &cut[0]);
+    for(unsigned j=0; j<m_channels.size(); j++)
+      m_channels[j]->_batch_result(r.channels[j], i, &cut[NCUTS*(j+1)]);
+  }
+}
+
+void Fex::_batch_result(RoiResults& r,
+                        unsigned i,
+                        const unsigned* cut) const
+{
+  r.position      [i] = _flt_position;
+  r.position_ps   [i] = _flt_position_ps;
+  r.fwhm          [i] = _flt_fwhm;
+  r.amplitude     [i] = _amplitude;
+  r.next_amplitude[i] = _nxt_amplitude;
+  r.ref_amplitude [i] = _ref_amplitude;
+  r.sig_roi_sum   [i] = _sig_roi_sum;
+  r.cut           [i] = Accepted;
+  for(unsigned k=NOLASER; k<NCUTS; k++)
+    if (_cut[k]!=cut[k]) {
+      r.cut[i] = k;
+      break;
+    }
+  r.edges.insert(r.edges.end(), _edges.begin(), _edges.begin()+_nedges);
+  r.edge_index[i+1] = r.edges.size();
+}
+
+//
+//  Event accounting and frame checks ahead of the analysis.  Returns
+//  false if the frame is not to be analysed.
+//
+bool Fex::_accept_frame(const ndarray<const uint16_t,2>& f,
+                        bool nolaser)
+{
+  _cut[NCALLS]++;
+
+  //
+  //  No-laser frames contribute to the pedestal map
+  //
+  if (nolaser) {
+    if (m_use_dark && f.size()) {
+      if (f.shape()[0]!=_frame_shape[0] ||
+          f.shape()[1]!=_frame_shape[1])
+        _validate_roi(f);
+      _update_dark(f);
+    }
+    _cut[NOLASER]++;
+    return false;
+  }
+
+  if (!f.size()) { _cut[FRAMESIZE]++; return false; }
+
+  //
+  //  The ROIs are validated against each new frame shape only
+  //
+  if (f.shape()[0]!=_frame_shape[0] ||
+      f.shape()[1]!=_frame_shape[1])
+    _validate_roi(f);
+
+  return true;
+}
+
+//
+//  Clip the ROIs to the frame and record the frame shape they are valid
+//  for.  Exceeding the frame along the projection axis is a
+//  configuration error, reported once for the frame shape.
+//
+void Fex::_validate_roi(const ndarray<const uint16_t,2>& f)
+{
+  _frame_shape[0] = f.shape()[0];
+  _frame_shape[1] = f.shape()[1];
+
+  //
+  //  The adaptive ROI is relearned within the clipped configured ROI
+  //
+  unsigned cdim = m_projectX ? 0:1;
+  if (m_adaptive_roi && _roi_changes) {
+    m_sb_avg  = ndarray<double,1>();
+    m_ref_avg = ndarray<double,1>();
+    ref_changed();
+  }
+  if (m_adaptive_roi) {
+    m_sig_roi_lo[cdim] = _roi_outer[0];
+    m_sig_roi_hi[cdim] = _roi_outer[1];
+    m_sb_roi_lo [cdim] = _sb_outer [0];
+    m_sb_roi_hi [cdim] = _sb_outer [1];
+  }
 
   std::string msg;
   for(unsigned i=0; i<2; i++) {
@@ -820,455 +1802,440 @@ void Fex::analyze(const ndarray<const uint16_t,2>& f,
       m_ref_roi_hi[i] = f.shape()[i]-1;
     }
   }
+
+  //
+  //  The ROI pedestals are rederived for the clipped ROIs; a pedestal
+  //  map learned for a different region is discarded
+  //
+  _dark_region();
+  if (m_dark_avg.size() &&
+      (m_dark_avg.shape()[0] != m_dark_hi[0]-m_dark_lo[0]+1 ||
+       m_dark_avg.shape()[1] != m_dark_hi[1]-m_dark_lo[1]+1))
+    m_dark_avg = ndarray<double,2>();
+  m_dark_gen++;
+
+  _compile_mask();
+
+  if (m_adaptive_roi) {
+    _roi_outer[0] = m_sig_roi_lo[cdim];
+    _roi_outer[1] = m_sig_roi_hi[cdim];
+    _sb_outer [0] = m_sb_roi_lo [cdim];
+    _sb_outer [1] = m_sb_roi_hi [cdim];
+    _roi_profile  = ndarray<double,1>();
+  }
+
   if (!msg.empty())
     throw msg;
+}
 
-  ndarray<double,1> sigd = ndarray<double,1>();
-  ndarray<double,1> refd = ndarray<double,1>();
+//
+//  Adaptive signal ROI.  The line profile of the configured signal ROI
+//  across the projection is averaged over the reference shots.  The
+//  signal ROI is narrowed to the lines of at least
+//  adaptive_roi_threshold of the brightest line, widened by
+//  adaptive_roi_margin lines, and the sideband ROI to the same number
+//  of lines from its configured start.  The ROI is widened as soon as
+//  the illuminated lines exceed it, but only narrowed when it has more
+//  than a margin of dark lines, so that it does not follow the noise.
+//
+//  The projections keep their length; the averages of the sideband and
+//  the reference are restarted for the new ROI.
+//
+void Fex::_adapt_roi(const ndarray<const uint16_t,2>& f)
+{
+  unsigned cdim = m_projectX ? 0:1;
+  unsigned n    = _roi_outer[1]-_roi_outer[0]+1;
+
+  unsigned lo[2], hi[2];
+  lo[0] = m_sig_roi_lo[0]; hi[0] = m_sig_roi_hi[0];
+  lo[1] = m_sig_roi_lo[1]; hi[1] = m_sig_roi_hi[1];
+  lo[cdim] = _roi_outer[0];
+  hi[cdim] = _roi_outer[1];
+
+  ndarray<int,1>& p = _ws->i1(Workspace::Profile, n);
+  Projector::project(f, lo, hi, m_pedestal, cdim, p.data());
+  psalg::rolling_average(ndarray<const int,1>(p), _roi_profile, m_ref_convergence);
+
+  double pmax = 0;
+  for(unsigned i=0; i<n; i++)
+    if (_roi_profile[i] > pmax)
+      pmax = _roi_profile[i];
+  if (!(pmax > 0))
+    return;
+
+  unsigned a = n, b = 0;
+  for(unsigned i=0; i<n; i++)
+    if (_roi_profile[i] >= m_adaptive_roi_threshold*pmax) {
+      if (a==n) a = i;
+      b = i;
+    }
+  a = a > m_adaptive_roi_margin ? a-m_adaptive_roi_margin : 0;
+  b = b+m_adaptive_roi_margin < n ? b+m_adaptive_roi_margin : n-1;
+
+  unsigned cur_lo = m_sig_roi_lo[cdim]-_roi_outer[0];
+  unsigned cur_hi = m_sig_roi_hi[cdim]-_roi_outer[0];
+  if (a >= cur_lo && b <= cur_hi &&
+      a <= cur_lo+m_adaptive_roi_margin &&
+      b+m_adaptive_roi_margin >= cur_hi)
+    return;
 
-  ndarray<double,2> sigd_full = ndarray<double,2>();
-  ndarray<double,2> refd_full = ndarray<double,2>();
+  m_sig_roi_lo[cdim] = _roi_outer[0]+a;
+  m_sig_roi_hi[cdim] = _roi_outer[0]+b;
+  if (m_use_sb_roi) {
+    m_sb_roi_lo[cdim] = _sb_outer[0];
+    m_sb_roi_hi[cdim] = _sb_outer[0]+b-a < _sb_outer[1] ? _sb_outer[0]+b-a : _sb_outer[1];
+    m_sb_avg = ndarray<double,1>();
+  }
+  m_ref_avg = ndarray<double,1>();
+  ref_changed();
 
   //
-  //  Project signal ROI
+  //  The ROI pedestals are rederived within the unchanged pedestal region
   //
-  unsigned pdim = m_projectX ? 1:0;
-  if (m_use_full_roi) {
-    m_sig_full = psalg::roi(f,
-                            m_sig_roi_lo,
-                            m_sig_roi_hi,
-                            m_pedestal);
+  m_dark_gen++;
+  _compile_mask();
+  _roi_changes++;
+
+  printf("TimeTool: adaptive signal roi %c [%u,%u]\n",
+         m_projectX ? 'Y':'X', m_sig_roi_lo[cdim], m_sig_roi_hi[cdim]);
+}
+
+//
+//  Frame pipeline, specialized on the configuration so that the ROI
+//  extraction carries no per-event branches on the options
+//
+template<bool full, bool sb, bool ref, bool fit>
+void Fex::_analyze_frame(const ndarray<const uint16_t,2>& f,
+                         bool nobeam)
+{
+  //
+  //  The signal pass produces the pedestal subtracted projection (or
+  //  ROI), its sum and its maximum.  Events failing the projection cut
+  //  are rejected before any reference or double precision work is
+  //  done (and, without a sideband, before the sideband pass).  The
+  //  pedestal is the learned per-pixel map once one exists, else the
+  //  scalar pedestal.
+  //
+  unsigned pdim = m_projectX ? 1:0;
+  bool dark = _dark_pedestal();
+  int smax;
+  double vmax;
+  if (full) {
+    unsigned rows = _binned(m_sig_roi_lo, m_sig_roi_hi, 0);
+    unsigned cols = _binned(m_sig_roi_lo, m_sig_roi_hi, 1);
+
     //
-    //  Calculate sum of signal roi and store
+    //  Extract signal roi and its sum
     //
-    _sig_roi_sum = sum_array(m_sig_full);
+    ndarray<int,2>& sig = _ws->i2(Workspace::SigRaw,rows,cols);
+    _sig_roi_sum = _extract_roi(f, m_sig_roi_lo, m_sig_roi_hi,
+                                dark ? _ws->i2(Workspace::DarkSig,rows,cols).data() : 0,
+                                sig.data(), smax);
+    m_sig_full = sig;
 
     //
-    //  Calculate sideband correction
+    //  Require projection has a minimum amplitude (else no laser).
+    //  Without a sideband the event is cut before any further work.
     //
-    if (m_use_sb_roi)
-      m_sb_full = psalg::roi(f,
-                             m_sb_roi_lo,
-                             m_sb_roi_hi,
-                             m_pedestal);
+    if (!sb && !(smax > m_proj_cut)) { _cut[PROJCUT]++; return; }
 
     //
-    //  Calculate reference correction
+    //  Calculate the sideband common mode of each row
     //
-    if (m_use_ref_roi)
-      m_ref_full = psalg::roi(f,
-                              m_ref_roi_lo,
-                              m_ref_roi_hi,
-                              m_pedestal);
-
-    sigd_full = make_ndarray<double>(m_sig_full.shape()[0],m_sig_full.shape()[1]);
-    refd_full = make_ndarray<double>(m_sig_full.shape()[0],m_sig_full.shape()[1]);
-  } else {
-    m_sig = psalg::project(f,
-                           m_sig_roi_lo,
-                           m_sig_roi_hi,
-                           m_pedestal, pdim);
+    ndarray<const double,2> sbm;
+    if (sb) {
+      ndarray<int,2>& sbr = _ws->i2(Workspace::SbRaw,
+                                    _binned(m_sb_roi_lo, m_sb_roi_hi, 0),
+                                    _binned(m_sb_roi_lo, m_sb_roi_hi, 1));
+      int sbmax;
+      _extract_roi(f, m_sb_roi_lo, m_sb_roi_hi,
+                   dark ? _ws->i2(Workspace::DarkSb,sbr.shape()[0],sbr.shape()[1]).data() : 0,
+                   sbr.data(), sbmax);
+      m_sb_full = sbr;
+      sbm = _sideband_means(m_sb_full);
+    }
 
     //
-    //  Calculate sum of signal roi and store
+    //  With a sideband the cut applies to the corrected signal
     //
-    _sig_roi_sum = sum_array(m_sig);
+    if (sb && !(Projector::maximum(sig.data(), rows, cols, sbm.data()) > m_proj_cut)) {
+      _cut[PROJCUT]++;
+      return;
+    }
 
     //
-    //  Calculate sideband correction
+    //  Extract reference roi
     //
-    if (m_use_sb_roi)
-      m_sb = psalg::project(f,
-                            m_sb_roi_lo,
-                            m_sb_roi_hi,
-                            m_pedestal, pdim);
+    if (ref) {
+      ndarray<int,2>& r = _ws->i2(Workspace::RefRaw,rows,cols);
+      int imax;
+      _extract_roi(f, m_ref_roi_lo, m_ref_roi_hi,
+                   dark ? _ws->i2(Workspace::DarkRef,
+                                  _binned(m_ref_roi_lo, m_ref_roi_hi, 0),
+                                  _binned(m_ref_roi_lo, m_ref_roi_hi, 1)).data() : 0,
+                   r.data(), imax);
+      m_ref_full = r;
+    }
 
     //
-    //  Calculate reference correction
+    //  Signal events only need the projections of the corrected and the
+    //  normalized signal, which are streamed row by row from the integer
+    //  regions together with the reference update.  The corrected
+    //  regions are made for reference events, before a reference of the
+    //  region shape exists, and for subclasses monitoring the full region.
     //
-    if (m_use_ref_roi)
-      m_ref = psalg::project(f,
-                             m_ref_roi_lo,
-                             m_ref_roi_hi,
-                             m_pedestal, pdim);
-
-    sigd = make_ndarray<double>(m_sig.shape()[0]);
-    refd = make_ndarray<double>(m_sig.shape()[0]);
-  }
-
-  //
-  //  Correct projection for common mode found in sideband
-  //
-  if (m_sb.size()) {
-    psalg::rolling_average(m_sb, m_sb_avg, m_sb_convergence);
-
-    ndarray<const double,1> sbc = psalg::commonModeLROE(m_sb, m_sb_avg);
+    if (!nobeam && !monitors_full() && m_ref_avg_full.size()==sig.size()) {
+      _analyze_streamed<ref,fit>(sig, m_ref_full, sb ? sbm.data() : 0);
+      return;
+    }
 
-    if (m_use_ref_roi)
-      for(unsigned i=0; i<m_sig.shape()[0]; i++) {
-        sigd[i] = double(m_sig[i])-sbc[i];
-        refd[i] = double(m_ref[i])-sbc[i];
-      }
-    else
-      for(unsigned i=0; i<m_sig.shape()[0]; i++)
-        sigd[i] = double(m_sig[i])-sbc[i];
-  }
-  else {
-    if (m_use_ref_roi)
-      for(unsigned i=0; i<m_sig.shape()[0]; i++) {
-        sigd[i] = double(m_sig[i]);
-        refd[i] = double(m_ref[i]);
-      }
-    else
-      for(unsigned i=0; i<m_sig.shape()[0]; i++)
-        sigd[i] = double(m_sig[i]);
-  }
+    const double* sbc = 0;
+    if (sb) {
+      ndarray<double,2>& c = _ws->d2(Workspace::SbCorr,rows,cols);
+      Filter::lroe_expand(sbm.data(), rows, cols, c.data());
+      sbc = c.data();
+    }
 
-  //
-  //  Correct full signal/reference for common mode found in sideband
-  //
-  if (m_sb_full.size()) {
-    psalg::rolling_average(m_sb_full, m_sb_avg_full, m_sb_convergence);
+    if (ref) {
+      double rmax;
+      Projector::correct(m_ref_full.data(), m_ref_full.size(), sbc,
+                         _ws->d2(Workspace::RefCorr,rows,cols).data(), rmax);
+    }
 
-    ndarray<const double,2> sbc = psalg::commonModeLROE(m_sb_full, m_sb_avg_full);
+    ndarray<double,2>& sigd = _ws->d2(Workspace::SigCorr,rows,cols);
+    Projector::correct(sig.data(), sig.size(), sbc, sigd.data(), vmax);
 
-    if (m_use_ref_roi)
-      for(unsigned i=0; i<m_sig_full.shape()[0]; i++) {
-        for(unsigned j=0; j<m_sig_full.shape()[1]; j++) {
-          sigd_full(i,j) = double(m_sig_full(i,j))-sbc(i,j);
-          refd_full(i,j) = double(m_ref_full(i,j))-sbc(i,j);
-        }
-      }
+    if (ref)
+      _analyze<2,true,fit>(nobeam, sigd, _ws->d2(Workspace::RefCorr,rows,cols));
     else
-      for(unsigned i=0; i<m_sig_full.shape()[0]; i++)
-        for(unsigned j=0; j<m_sig_full.shape()[1]; j++)
-          sigd_full(i,j) = double(m_sig_full(i,j))-sbc(i,j);
+      _analyze<2,false,fit>(nobeam, sigd, sigd);
   }
   else {
-    if (m_use_ref_roi)
-      for(unsigned i=0; i<m_sig_full.shape()[0]; i++) {
-        for(unsigned j=0; j<m_sig_full.shape()[1]; j++) {
-          sigd_full(i,j) = double(m_sig_full(i,j));
-          refd_full(i,j) = double(m_ref_full(i,j));
-        }
-      }
-    else
-      for(unsigned i=0; i<m_sig_full.shape()[0]; i++)
-        for(unsigned j=0; j<m_sig_full.shape()[1]; j++)
-          sigd_full(i,j) = double(m_sig_full(i,j));
-  }
-
-  //
-  //  Require projection has a minimum amplitude (else no laser)
-  //
-  bool lcut=true;
-  if (m_use_full_roi) {
-    for(unsigned i=0; i<sigd_full.shape()[0]; i++)
-      for(unsigned j=0; j<sigd_full.shape()[1]; j++)
-        if (sigd_full(i,j)>m_proj_cut)
-          lcut=false;
-  } else {
-    for(unsigned i=0; i<sigd.shape()[0]; i++)
-      if (sigd[i]>m_proj_cut)
-        lcut=false;
-  }
-
-  if (lcut) { _cut[PROJCUT]++; return; }
-
-  //
-  //  create projections for sig and ref if using non-projected
-  //
-  if (m_use_full_roi) {
-    sigd = psalg::project(sigd_full, 0.0, pdim);
-
-    if (m_use_ref_roi)
-      refd = psalg::project(refd_full, 0.0, pdim);
-  }
-
-  if (nobeam) {
-    _monitor_ref_sig( m_use_ref_roi ? refd:sigd );
-    if (m_use_full_roi) {
-      _monitor_ref_sig_full( m_use_ref_roi ? refd_full:sigd_full );
-      psalg::rolling_average(ndarray<const double,2>(m_use_ref_roi ? refd_full:sigd_full),
-                             m_ref_avg_full, m_ref_convergence);
-    } else {
-      psalg::rolling_average(ndarray<const double,1>(m_use_ref_roi ? refd:sigd),
-                             m_ref_avg, m_ref_convergence);
-    }
-    _cut[NOBEAM]++;
-    return;
-  }
-  else if (m_use_ref_roi) {
-    _monitor_ref_sig( refd );
-    if (m_use_full_roi) {
-      _monitor_ref_sig_full( refd_full );
-      psalg::rolling_average(ndarray<const double,2>(refd_full),
-                             m_ref_avg_full, m_ref_convergence);
-    } else {
-      psalg::rolling_average(ndarray<const double,1>(refd),
-                             m_ref_avg, m_ref_convergence);
-    }
-  }
-
-  _monitor_raw_sig( sigd );
-  if (m_use_full_roi)
-    _monitor_raw_sig_full( sigd_full );
+    unsigned sz = m_sig_roi_hi[pdim]-m_sig_roi_lo[pdim]+1;
 
-  if ((m_use_full_roi ? m_ref_avg_full.size() : m_ref_avg.size()) == 0) {
-    _cut[NOREF]++;
-    return;
-  } else {
-  }
-
-  //
-  //  Divide by the reference
-  //
-  if (m_use_full_roi) {
-    for(unsigned i=0; i<sigd_full.shape()[0]; i++)
-      for(unsigned j=0; j<sigd_full.shape()[1]; j++)
-        sigd_full(i,j) = sigd_full(i,j)/m_ref_avg_full(i,j) - m_ref_offset;
-    _monitor_sub_sig_full( sigd_full );
-    // update the signal projection a final time
-    sigd = psalg::project(sigd_full, 0.0, pdim);
-  } else {
-    for(unsigned i=0; i<sigd.shape()[0]; i++)
-      sigd[i] = sigd[i]/m_ref_avg[i] - m_ref_offset;
-  }
-
-  _monitor_sub_sig( sigd );
-
-  if (m_use_fit) {
-    double chisq = 0.;
-    ndarray<double,1> params = make_ndarray<double>(Fitter::nparams);
-    ndarray<double,1> errors = make_ndarray<double>(Fitter::nparams);
-    ndarray<double,1> qwf = make_ndarray<double>(sigd.size());
+    //
+    //  Project signal roi and its sum
+    //
+    ndarray<int,1>& sig = _ws->i1(Workspace::SigRaw,sz);
+    _sig_roi_sum = _project_roi(f, m_sig_roi_lo, m_sig_roi_hi, *_sig_mask,
+                                dark ? _ws->i1(Workspace::DarkSig,sz).data() : 0,
+                                sig.data(), smax);
+    m_sig = sig;
 
-    bool converged = _fitter->fit(sigd, params, errors, chisq);
+    //
+    //  Require projection has a minimum amplitude (else no laser).
+    //  Without a sideband the event is cut before any further work.
+    //
+    if (!sb && !(smax > m_proj_cut)) { _cut[PROJCUT]++; return; }
 
-    for (unsigned i=0; i<qwf.size(); i++) {
-      qwf[i] = Fitter::erf(i, params[0], params[1], params[2], params[3]);
+    //
+    //  Calculate sideband correction
+    //
+    ndarray<const double,1> sbc;
+    if (sb) {
+      ndarray<int,1>& sbr = _ws->i1(Workspace::SbRaw,sz);
+      int sbmax;
+      _project_roi(f, m_sb_roi_lo, m_sb_roi_hi, *_sb_mask,
+                   dark ? _ws->i1(Workspace::DarkSb,sz).data() : 0,
+                   sbr.data(), sbmax);
+      m_sb = sbr;
+      sbc = _sideband(m_sb);
     }
 
-    _monitor_flt_sig( qwf );
-    if (converged) {
-      double xflt = params[2]+m_sig_roi_lo[pdim]+m_frame_roi[pdim]+m_flt_offset;
-
-      double  xfltc = 0;
-      for(unsigned i=m_calib_poly.size(); i!=0; )
-        xfltc = xfltc*xflt + m_calib_poly[--i];
-
-      _amplitude = params[0];
-      _flt_position = xflt;
-      _flt_position_ps = xfltc;
-      _flt_fwhm = params[1];
-      _ref_amplitude = params[3];
-      _nxt_amplitude = chisq;
-    } else {
-      _cut[NOFITS]++;
-    }
-  } else {
     //
-    //  Apply the digital filter
+    //  With a sideband the cut applies to the corrected signal
     //
-    ndarray<double,1> qwf = psalg::finite_impulse_response(m_weights,sigd);
+    if (sb && !(Projector::maximum(sig.data(), sig.size(), sbc.data()) > m_proj_cut)) {
+      _cut[PROJCUT]++;
+      return;
+    }
 
-    _monitor_flt_sig( qwf );
+    ndarray<double,1>& sigd = _ws->d1(Workspace::SigCorr,sz);
+    Projector::correct(sig.data(), sig.size(), sb ? sbc.data() : 0,
+                       sigd.data(), vmax);
 
     //
-    //  Find the two highest peaks that are well-separated
+    //  Calculate reference correction
     //
-    const double afrac = 0.50;
-    std::list<unsigned> peaks =
-      psalg::find_peaks(qwf, afrac, 2);
-
-    unsigned nfits = peaks.size();
-    if (nfits>0) {
-      unsigned ix = *peaks.begin();
-      ndarray<double,1> pFit0 = psalg::parab_fit(qwf,ix,0.8);
-      if (pFit0[2]>0) {
-        double   xflt = pFit0[1]+m_sig_roi_lo[pdim]+m_frame_roi[pdim]+m_flt_offset;
-
-        double  xfltc = 0;
-        for(unsigned i=m_calib_poly.size(); i!=0; )
-          xfltc = xfltc*xflt + m_calib_poly[--i];
-
-        _amplitude = pFit0[0];
-        _flt_position  = xflt;
-        _flt_position_ps  = xfltc;
-        _flt_fwhm      = pFit0[2];
-        _ref_amplitude = m_use_full_roi ?
-          psalg::project(m_ref_avg_full,0.0,pdim)[ix] :
-          m_ref_avg[ix];
-
-        if (nfits>1) {
-          ndarray<double,1> pFit1 =
-            psalg::parab_fit(qwf,*(++peaks.begin()),0.8);
-          if (pFit1[2]>0)
-            _nxt_amplitude = pFit1[0];
-        }
+    if (ref) {
+      ndarray<int,1>&    r    = _ws->i1(Workspace::RefRaw ,sz);
+      ndarray<double,1>& refd = _ws->d1(Workspace::RefCorr,sz);
+      double rmax;
+      if (dark || !_ref_mask->empty()) {
+        int imax;
+        _project_roi(f, m_ref_roi_lo, m_ref_roi_hi, *_ref_mask,
+                     dark ? _ws->i1(Workspace::DarkRef,sz).data() : 0,
+                     r.data(), imax);
+        Projector::correct(r.data(), r.size(), sb ? sbc.data() : 0,
+                           refd.data(), rmax);
       }
+      else
+        Projector::project(f, m_ref_roi_lo, m_ref_roi_hi, m_pedestal, pdim,
+                           sb ? sbc.data() : 0,
+                           r.data(), refd.data(), rmax);
+      m_ref = r;
+      _analyze<1,true,fit>(nobeam, sigd, refd);
     }
     else
-      _cut[NOFITS]++;
+      _analyze<1,false,fit>(nobeam, sigd, sigd);
   }
 }
 
-void Fex::analyze(EventType etype,
-                  const ndarray<const int,1>& signal,
-                  const ndarray<const int,1>& sideband)
+//
+//  Projected ROIs of this Fex and its channels are all extracted in one
+//  traversal of the frame.  Each channel then continues from its own
+//  projections.
+//
+void Fex::_analyze_channels(const ndarray<const uint16_t,2>& f,
+                            bool nobeam)
 {
-  _cut[NCALLS]++;
-
-  bool nolaser   = (etype == Dark);
-
-  bool nobeam    = (etype == Reference);
-
-#ifdef DBUG
-  printf("beam %c  laser %c\n",
-         nobeam ? 'F':'T', nolaser ? 'F':'T');
-#endif
-
-  if (nolaser) { _cut[NOLASER]++; return; }
-
-  if (!signal.size()) { _cut[FRAMESIZE]++; return; }
-
   unsigned pdim = m_projectX ? 1:0;
-  m_sig = signal;
-  m_sb  = sideband;
-
-  ndarray<double,1> sigd = make_ndarray<double>(m_sig.shape()[0]);
+  unsigned n = 0;
+  for(unsigned i=0; i<=m_channels.size(); i++) {
+    const Fex& c = i ? *m_channels[i-1] : *this;
+    n += 1 + (c.m_use_sb_roi ? 1:0) + (c.m_use_ref_roi ? 1:0);
+  }
+  std::vector<Projector::Region>& g = _ws->regions(n);
+
+  unsigned k = 0;
+  for(unsigned i=0; i<=m_channels.size(); i++) {
+    Fex& c = i ? *m_channels[i-1] : *this;
+    bool dark = c._dark_pedestal();
+    unsigned sz = c.m_sig_roi_hi[pdim]-c.m_sig_roi_lo[pdim]+1;
+
+    Projector::Region r;
+    r.pedestal = c.m_pedestal;
+    r.lo    = c.m_sig_roi_lo;
+    r.hi    = c.m_sig_roi_hi;
+    r.mask  = c._sig_mask;
+    r.dproj = dark ? c._ws->i1(Workspace::DarkSig,sz).data() : 0;
+    r.proj  = c._ws->i1(Workspace::SigRaw,sz).data();
+    g[k++] = r;
+    if (c.m_use_sb_roi) {
+      r.lo    = c.m_sb_roi_lo;
+      r.hi    = c.m_sb_roi_hi;
+      r.mask  = c._sb_mask;
+      r.dproj = dark ? c._ws->i1(Workspace::DarkSb,sz).data() : 0;
+      r.proj  = c._ws->i1(Workspace::SbRaw,sz).data();
+      g[k++] = r;
+    }
+    if (c.m_use_ref_roi) {
+      r.lo    = c.m_ref_roi_lo;
+      r.hi    = c.m_ref_roi_hi;
+      r.mask  = c._ref_mask;
+      r.dproj = dark ? c._ws->i1(Workspace::DarkRef,sz).data() : 0;
+      r.proj  = c._ws->i1(Workspace::RefRaw,sz).data();
+      g[k++] = r;
+    }
+  }
 
-  //
-  //  Calculate sum of signal roi and store
-  //
-  _sig_roi_sum = sum_array(m_sig);
+  Projector::project(f, pdim, &g[0], k);
+
+  k = 0;
+  for(unsigned i=0; i<=m_channels.size(); i++) {
+    Fex& c = i ? *m_channels[i-1] : *this;
+    unsigned sz = c.m_sig_roi_hi[pdim]-c.m_sig_roi_lo[pdim]+1;
+    int smax = g[k].vmax;
+    c._sig_roi_sum = g[k++].sum;
+    c.m_sig = c._ws->i1(Workspace::SigRaw,sz);
+    if (c.m_use_sb_roi) {
+      c.m_sb = c._ws->i1(Workspace::SbRaw,sz);
+      k++;
+    }
+    if (c.m_use_ref_roi) {
+      c.m_ref = c._ws->i1(Workspace::RefRaw,sz);
+      k++;
+    }
+    (c.*c._channel_pipeline)(nobeam, smax);
+  }
+}
 
+//
+//  Projected pipeline continuing from the integer projections made in
+//  the frame pass
+//
+template<bool sb, bool ref, bool fit>
+void Fex::_analyze_projected(bool nobeam,
+                             int  smax)
+{
   //
-  //  Correct projection for common mode found in sideband
+  //  Require projection has a minimum amplitude (else no laser).  With
+  //  a sideband the cut applies to the corrected signal.
   //
-  if (m_sb.size()) {
-    psalg::rolling_average(m_sb, m_sb_avg, m_sb_convergence);
+  if (!sb && !(smax > m_proj_cut)) { _cut[PROJCUT]++; return; }
 
-    ndarray<const double,1> sbc = psalg::commonModeLROE(m_sb, m_sb_avg);
-
-    for(unsigned i=0; i<m_sig.shape()[0]; i++)
-      sigd[i] = double(m_sig[i])-sbc[i];
-  }
-  else {
-    for(unsigned i=0; i<m_sig.shape()[0]; i++)
-      sigd[i] = double(m_sig[i]);
-  }
+  unsigned sz = m_sig.size();
 
   //
-  //  Require projection has a minimum amplitude (else no laser)
+  //  Calculate sideband correction
   //
-  bool lcut=true;
-  for(unsigned i=0; i<sigd.shape()[0]; i++)
-    if (sigd[i]>m_proj_cut)
-      lcut=false;
-
-  if (lcut) { _cut[PROJCUT]++; return; }
-
-  if (nobeam) {
-    _monitor_ref_sig( sigd );
-    psalg::rolling_average(ndarray<const double,1>(sigd),
-                           m_ref_avg, m_ref_convergence);
-    _cut[NOBEAM]++;
-    return;
+  ndarray<const double,1> sbc;
+  if (sb) {
+    sbc = _sideband(m_sb);
+    if (!(Projector::maximum(m_sig.data(), sz, sbc.data()) > m_proj_cut)) {
+      _cut[PROJCUT]++;
+      return;
+    }
   }
 
-  _monitor_raw_sig( sigd );
-
-  if (m_ref_avg.size()==0) {
-    _cut[NOREF]++;
-    return;
-  }
+  ndarray<double,1>& sigd = _ws->d1(Workspace::SigCorr,sz);
+  double vmax;
+  Projector::correct(m_sig.data(), sz, sb ? sbc.data() : 0,
+                     sigd.data(), vmax);
 
   //
-  //  Divide by the reference
+  //  Calculate reference correction
   //
-  for(unsigned i=0; i<sigd.shape()[0]; i++)
-    sigd[i] = sigd[i]/m_ref_avg[i] - m_ref_offset;
-
-  _monitor_sub_sig( sigd );
-
-  if (m_use_fit) {
-    double chisq = 0.;
-    ndarray<double,1> params = make_ndarray<double>(Fitter::nparams);
-    ndarray<double,1> errors = make_ndarray<double>(Fitter::nparams);
-    ndarray<double,1> qwf = make_ndarray<double>(sigd.size());
-
-    bool converged = _fitter->fit(sigd, params, errors, chisq);
-
-    for (unsigned i=0; i<qwf.size(); i++) {
-      qwf[i] = Fitter::erf(i, params[0], params[1], params[2], params[3]);
-    }
-
-    _monitor_flt_sig( qwf );
-    if (converged) {
-      double xflt = params[2]+m_sig_roi_lo[pdim]+m_frame_roi[pdim]+m_flt_offset;
-
-      double  xfltc = 0;
-      for(unsigned i=m_calib_poly.size(); i!=0; )
-        xfltc = xfltc*xflt + m_calib_poly[--i];
+  if (ref) {
+    ndarray<double,1>& refd = _ws->d1(Workspace::RefCorr,sz);
+    double rmax;
+    Projector::correct(m_ref.data(), sz, sb ? sbc.data() : 0,
+                       refd.data(), rmax);
+    _analyze<1,true,fit>(nobeam, sigd, refd);
+  }
+  else
+    _analyze<1,false,fit>(nobeam, sigd, sigd);
+}
 
-      _amplitude = params[0];
-      _flt_position = xflt;
-      _flt_position_ps = xfltc;
-      _flt_fwhm = params[1];
-      _ref_amplitude = params[3];
-      _nxt_amplitude = chisq;
-    } else {
-      _cut[NOFITS]++;
-    }
-  } else {
-    //
-    //  Apply the digital filter
-    //
-    ndarray<double,1> qwf = psalg::finite_impulse_response(m_weights,sigd);
+void Fex::analyze(EventType etype,
+                  const ndarray<const int,1>& signal,
+                  const ndarray<const int,1>& sideband)
+{
+  _analyze_input(etype, signal, sideband, ndarray<const int,1>());
+}
 
-    _monitor_flt_sig( qwf );
+void Fex::analyze(EventType etype,
+                  const ndarray<const int,2>& signal,
+                  const ndarray<const int,2>& sideband)
+{
+  _analyze_input(etype, signal, sideband, ndarray<const int,2>());
+}
 
-    //
-    //  Find the two highest peaks that are well-separated
-    //
-    const double afrac = 0.50;
-    std::list<unsigned> peaks =
-      psalg::find_peaks(qwf, afrac, 2);
-
-    unsigned nfits = peaks.size();
-    if (nfits>0) {
-      unsigned ix = *peaks.begin();
-      ndarray<double,1> pFit0 = psalg::parab_fit(qwf,ix,0.8);
-      if (pFit0[2]>0) {
-        double   xflt = pFit0[1]+m_sig_roi_lo[pdim]+m_frame_roi[pdim]+m_flt_offset;
-
-        double  xfltc = 0;
-        for(unsigned i=m_calib_poly.size(); i!=0; )
-          xfltc = xfltc*xflt + m_calib_poly[--i];
-
-        _amplitude = pFit0[0];
-        _flt_position  = xflt;
-        _flt_position_ps  = xfltc;
-        _flt_fwhm      = pFit0[2];
-        _ref_amplitude = m_ref_avg[ix];
-
-        if (nfits>1) {
-          ndarray<double,1> pFit1 =
-            psalg::parab_fit(qwf,*(++peaks.begin()),0.8);
-          if (pFit1[2]>0)
-            _nxt_amplitude = pFit1[0];
-        }
-      }
-    }
-    else
-      _cut[NOFITS]++;
-  }
+void Fex::analyze(EventType etype,
+                  const ndarray<const int,1>& signal,
+                  const ndarray<const int,1>& sideband,
+                  const ndarray<const int,1>& reference)
+{
+  _analyze_input(etype, signal, sideband, reference);
 }
 
 void Fex::analyze(EventType etype,
                   const ndarray<const int,2>& signal,
-                  const ndarray<const int,2>& sideband)
+                  const ndarray<const int,2>& sideband,
+                  const ndarray<const int,2>& reference)
+{
+  _analyze_input(etype, signal, sideband, reference);
+}
+
+//
+//  Pipeline for externally extracted (projected or full) regions.  The
+//  reference region, if any, is only accumulated on reference events.
+//
+template<unsigned N>
+void Fex::_analyze_input(EventType etype,
+                         const ndarray<const int,N>& signal,
+                         const ndarray<const int,N>& sideband,
+                         const ndarray<const int,N>& reference)
 {
   _cut[NCALLS]++;
 
@@ -1285,92 +2252,211 @@ void Fex::analyze(EventType etype,
 
   if (!signal.size()) { _cut[FRAMESIZE]++; return; }
 
-  unsigned pdim = m_projectX ? 1:0;
-  m_sig_full = signal;
-  m_sb_full  = sideband;
-
-  ndarray<double,2> sigd_full = make_ndarray<double>(m_sig_full.shape()[0],m_sig_full.shape()[1]);
+  _store(signal, sideband, reference);
 
   //
-  //  Calculate sum of signal roi and store
+  //  Calculate sum of signal roi and require it has a minimum
+  //  amplitude (else no laser).  With a sideband the cut applies to
+  //  the corrected signal.
   //
-  _sig_roi_sum = sum_array(m_sig_full);
+  int smax;
+  _sig_roi_sum = Projector::sum(signal.data(), signal.size(), smax);
+
+  if (!sideband.size() && !(smax > m_proj_cut)) { _cut[PROJCUT]++; return; }
 
   //
   //  Correct projection for common mode found in sideband
   //
-  if (m_sb.size()) {
-    psalg::rolling_average(m_sb_full, m_sb_avg_full, m_sb_convergence);
+  ndarray<const double,N> sbc;
+  if (sideband.size()) {
+    sbc = _sideband(sideband);
+    if (!(Projector::maximum(signal.data(), signal.size(), sbc.data()) > m_proj_cut)) {
+      _cut[PROJCUT]++;
+      return;
+    }
+  }
 
-    ndarray<const double,2> sbc = psalg::commonModeLROE(m_sb_full, m_sb_avg_full);
+  ndarray<double,N>& sigd = _ws->d(Workspace::SigCorr, signal);
+  double vmax;
+  Projector::correct(signal.data(), signal.size(),
+                     sbc.size() ? sbc.data() : 0,
+                     sigd.data(), vmax);
 
-    for(unsigned i=0; i<m_sig_full.shape()[0]; i++)
-      for(unsigned j=0; j<m_sig_full.shape()[1]; j++)
-        sigd_full(i,j) = double(m_sig_full(i,j))-sbc(i,j);
+  //
+  //  Corrected reference region for the reference average
+  //
+  if (nobeam && reference.size()) {
+    ndarray<double,N>& refd = _ws->d(Workspace::RefCorr, signal);
+    double rmax;
+    Projector::correct(reference.data(), signal.size(),
+                       sbc.size() ? sbc.data() : 0,
+                       refd.data(), rmax);
+    if (_fit())
+      _analyze<N,false,true >(nobeam, sigd, refd);
+    else
+      _analyze<N,false,false>(nobeam, sigd, refd);
   }
   else {
-    for(unsigned i=0; i<m_sig_full.shape()[0]; i++)
-      for(unsigned j=0; j<m_sig_full.shape()[1]; j++)
-        sigd_full(i,j) = double(m_sig_full(i,j));
+    if (_fit())
+      _analyze<N,false,true >(nobeam, sigd, sigd);
+    else
+      _analyze<N,false,false>(nobeam, sigd, sigd);
   }
+}
+
+//
+//  Stages common to all inputs: reference accumulation, normalization
+//  by the reference and edge finding.  The reference average is updated
+//  from refd on reference events, and on every event if ref is set.
+//
+template<unsigned N, bool ref, bool fit>
+void Fex::_analyze(bool nobeam,
+                   ndarray<double,N>& sigd,
+                   const ndarray<double,N>& refd)
+{
+  unsigned pdim = m_projectX ? 1:0;
 
   //
-  //  Require projection has a minimum amplitude (else no laser)
+  //  create projections for sig and ref if using non-projected
   //
-  bool lcut=true;
-  for(unsigned i=0; i<sigd_full.shape()[0]; i++)
-    for(unsigned j=0; j<m_sig_full.shape()[1]; j++)
-      if (sigd_full(i,j)>m_proj_cut)
-        lcut=false;
+  const ndarray<double,1>& sigp = _project(*_ws, Workspace::SigProj, sigd, pdim);
 
-  if (lcut) { _cut[PROJCUT]++; return; }
+  if (nobeam || ref) {
+    //  an existing reference is not updated while load is shed
+    if (_shed && (N==1 ? m_ref_avg.size() : m_ref_avg_full.size()))
+      _degraded = true;
+    else
+      _reference(refd, refd.data()==sigd.data() ?
+                 sigp : _project(*_ws, Workspace::RefProj, refd, pdim));
+    if (nobeam) {
+      _cut[NOBEAM]++;
+      return;
+    }
+  }
 
-  ndarray<double,1> sigd = psalg::project(sigd_full, 0.0, pdim);
+  _monitor_raw(sigp, sigd);
 
-  if (nobeam) {
-    _monitor_ref_sig( sigd );
-    _monitor_ref_sig_full( sigd_full );
-    psalg::rolling_average(ndarray<const double,2>(sigd_full),
-                           m_ref_avg_full, m_ref_convergence);
-    _cut[NOBEAM]++;
+  //
+  //  Divide by the reference.  The single precision filter takes the
+  //  normalized projection in float directly.
+  //
+  if (!fit && _single()) {
+    ndarray<float,1>& sigf = _ws->f1(Workspace::SigProjF, sigp.size());
+    if (!_normalize(sigd, sigf)) {
+      _cut[NOREF]++;
+      return;
+    }
+    const ndarray<const float,1> sig(sigf);
+    _monitor_sub(sig, sigd);
+    _filter_edge<N>(sig);
     return;
   }
 
-  _monitor_raw_sig ( sigd );
-  _monitor_raw_sig_full( sigd_full );
-
-  if (m_ref_avg_full.size()==0) {
+  if (!_normalize(sigd)) {
     _cut[NOREF]++;
     return;
   }
 
-  //
-  //  Divide by the reference
-  //
-  for(unsigned i=0; i<sigd_full.shape()[0]; i++)
-    for(unsigned j=0; j<sigd_full.shape()[1]; j++)
-      sigd_full(i,j) = sigd_full(i,j)/m_ref_avg_full(i,j) - m_ref_offset;
+  // update the signal projection a final time
+  const ndarray<const double,1> sig(_project(*_ws, Workspace::SigProj, sigd, pdim));
 
-  sigd = psalg::project(sigd_full, 0.0, pdim);
+  _monitor_sub(sig, sigd);
 
-  _monitor_sub_sig( sigd );
-  _monitor_sub_sig_full( sigd_full );
+  _find_edge<N,fit>(sig);
+}
 
-  if (m_use_fit) {
+//
+//  Streamed full region pipeline for signal events.  The signal is
+//  corrected by the sideband common mode of each row, normalized and
+//  projected in a single pass over the integer region without a double
+//  precision copy.  With a reference region the reference average is
+//  updated in the same pass, row by row ahead of the signal.
+//
+template<bool ref, bool fit>
+void Fex::_analyze_streamed(const ndarray<const int,2>& signal,
+                            const ndarray<const int,2>& reference,
+                            const double* sideband)
+{
+  unsigned pdim = m_projectX ? 1:0;
+  unsigned rows = signal.shape()[0];
+  unsigned cols = signal.shape()[1];
+
+  //  an existing reference is not updated while load is shed
+  bool update = ref && !_shed;
+  if (ref && _shed)
+    _degraded = true;
+
+  ndarray<double,1>& refp = _ws->d1(Workspace::RefProj, signal.shape()[pdim]);
+  ndarray<double,1>& sigp = _ws->d1(Workspace::SigProj, signal.shape()[pdim]);
+  if (!fit && _single()) {
+    ndarray<float,1>& sigf = _ws->f1(Workspace::SigProjF, signal.shape()[pdim]);
+    if (update)
+      Projector::normalize(signal.data(), reference.data(), rows, cols, sideband,
+                           m_ref_convergence, m_ref_avg_full.data(), _ref_offset(),
+                           pdim, refp.data(), sigp.data(), sigf.data());
+    else
+      Projector::normalize(signal.data(), rows, cols, sideband,
+                           _ref_reciprocal_full().data(), _ref_offset(),
+                           pdim, sigp.data(), sigf.data());
+    const ndarray<const float,1> sig(sigf);
+
+    if (update) {
+      ref_changed();
+      _monitor_ref_sig( refp );
+    }
+    _monitor_raw_sig( sigp );
+    _monitor_sub_sig( sig );
+
+    _filter_edge<2>(sig);
+    return;
+  }
+
+  ndarray<double,1>& sigd = _ws->d1(Workspace::SubProj, signal.shape()[pdim]);
+  if (update)
+    Projector::normalize(signal.data(), reference.data(), rows, cols, sideband,
+                         m_ref_convergence, m_ref_avg_full.data(), _ref_offset(),
+                         pdim, refp.data(), sigp.data(), sigd.data());
+  else
+    Projector::normalize(signal.data(), rows, cols, sideband,
+                         _ref_reciprocal_full().data(), _ref_offset(),
+                         pdim, sigp.data(), sigd.data());
+  const ndarray<const double,1> sig(sigd);
+
+  if (update) {
+    ref_changed();
+    _monitor_ref_sig( refp );
+  }
+  _monitor_raw_sig( sigp );
+  _monitor_sub_sig( sig );
+
+  _find_edge<2,fit>(sig);
+}
+
+//
+//  Locate the edge in the normalized signal projection
+//
+template<unsigned N, bool fit>
+void Fex::_find_edge(const ndarray<const double,1>& sig)
+{
+  unsigned pdim = m_projectX ? 1:0;
+
+  if (fit) {
     double chisq = 0.;
-    ndarray<double,1> params = make_ndarray<double>(Fitter::nparams);
-    ndarray<double,1> errors = make_ndarray<double>(Fitter::nparams);
-    ndarray<double,1> qwf = make_ndarray<double>(sigd.size());
+    ndarray<double,1>& params = _ws->d1(Workspace::FitParams, Fitter::nparams);
+    ndarray<double,1>& errors = _ws->d1(Workspace::FitErrors, Fitter::nparams);
+    ndarray<double,1>& qwf    = _ws->d1(Workspace::FitModel , sig.size());
 
-    bool converged = _fitter->fit(sigd, params, errors, chisq);
+    bool converged = _fitter->fit(sig, params, errors, chisq);
 
     for (unsigned i=0; i<qwf.size(); i++) {
       qwf[i] = Fitter::erf(i, params[0], params[1], params[2], params[3]);
     }
 
-    _monitor_flt_sig( qwf );
+    _monitor_flt_sig( ndarray<const double,1>(qwf) );
     if (converged) {
-      double xflt = params[2]+m_sig_roi_lo[pdim]+m_frame_roi[pdim]+m_flt_offset;
+      //  binned sample k is centred on pixel k*bin+(bin-1)/2 of the ROI
+      double bin  = m_bin[pdim];
+      double xflt = params[2]*bin+m_sig_roi_lo[pdim]+m_frame_roi[pdim]+m_flt_offset*bin+(bin-1)*0.5;
 
       double  xfltc = 0;
       for(unsigned i=m_calib_poly.size(); i!=0; )
@@ -1379,401 +2465,450 @@ void Fex::analyze(EventType etype,
       _amplitude = params[0];
       _flt_position = xflt;
       _flt_position_ps = xfltc;
-      _flt_fwhm = params[1];
+      _flt_fwhm = params[1]*bin;
       _ref_amplitude = params[3];
       _nxt_amplitude = chisq;
     } else {
       _cut[NOFITS]++;
     }
-  } else {
-    //
-    //  Apply the digital filter
-    //
-    ndarray<double,1> qwf = psalg::finite_impulse_response(m_weights,sigd);
-
-    _monitor_flt_sig( qwf );
-
-    //
-    //  Find the two highest peaks that are well-separated
-    //
-    const double afrac = 0.50;
-    std::list<unsigned> peaks =
-      psalg::find_peaks(qwf, afrac, 2);
-
-    unsigned nfits = peaks.size();
-    if (nfits>0) {
-      unsigned ix = *peaks.begin();
-      ndarray<double,1> pFit0 = psalg::parab_fit(qwf,ix,0.8);
-      if (pFit0[2]>0) {
-        double   xflt = pFit0[1]+m_sig_roi_lo[pdim]+m_frame_roi[pdim]+m_flt_offset;
-
-        double  xfltc = 0;
-        for(unsigned i=m_calib_poly.size(); i!=0; )
-          xfltc = xfltc*xflt + m_calib_poly[--i];
-
-        _amplitude = pFit0[0];
-        _flt_position  = xflt;
-        _flt_position_ps  = xfltc;
-        _flt_fwhm      = pFit0[2];
-        _ref_amplitude = psalg::project(m_ref_avg_full,0.0,pdim)[ix];
-
-        if (nfits>1) {
-          ndarray<double,1> pFit1 =
-            psalg::parab_fit(qwf,*(++peaks.begin()),0.8);
-          if (pFit1[2]>0)
-            _nxt_amplitude = pFit1[0];
-        }
-      }
-    }
-    else
-      _cut[NOFITS]++;
-  }
+  } else
+    _filter_edge<N>(sig);
 }
 
-void Fex::analyze(EventType etype,
-                  const ndarray<const int,1>& signal,
-                  const ndarray<const int,1>& sideband,
-                  const ndarray<const int,1>& reference)
+//
+//  Locate the edge in the normalized signal projection with the digital
+//  filter, in the precision of the projection
+//
+template<unsigned N, class T>
+void Fex::_filter_edge(const ndarray<const T,1>& sig)
 {
-  _cut[NCALLS]++;
-
-  bool nolaser   = (etype == Dark);
-
-  bool nobeam    = (etype == Reference);
-
-#ifdef DBUG
-  printf("beam %c  laser %c\n",
-         nobeam ? 'F':'T', nolaser ? 'F':'T');
-#endif
-
-  if (nolaser) { _cut[NOLASER]++; return; }
-
-  if (!signal.size()) { _cut[FRAMESIZE]++; return; }
-
-  unsigned pdim = m_projectX ? 1:0;
-  m_sig = signal;
-  m_sb  = sideband;
-  m_ref = reference;
-
-  ndarray<double,1> sigd = make_ndarray<double>(m_sig.shape()[0]);
-  ndarray<double,1> refd = make_ndarray<double>(m_sig.shape()[0]);
-
-  //
-  //  Calculate sum of signal roi and store
-  //
-  _sig_roi_sum = sum_array(m_sig);
+  //  a fit configuration reaches here only while load is shed
+  if (m_use_fit)
+    _degraded = true;
 
   //
-  //  Correct projection for common mode found in sideband
+  //  Apply the digital filter.  A tracked edge is searched for within
+  //  a window around its predicted position, then within a window
+  //  around the edge located by the coarse filter; the whole
+  //  projection is searched if no plausible edge is found there.
   //
-  if (m_sb.size()) {
-    psalg::rolling_average(m_sb, m_sb_avg, m_sb_convergence);
-
-    ndarray<const double,1> sbc = psalg::commonModeLROE(m_sb, m_sb_avg);
-
-    for(unsigned i=0; i<m_sig.shape()[0]; i++) {
-      sigd[i] = double(m_sig[i])-sbc[i];
-      refd[i] = double(m_ref[i])-sbc[i];
+  unsigned imax, lo, hi;
+  if (_track_window(sig.size(), lo, hi)) {
+    const ndarray<const T,1> qwf(_filter_window(*_ws, *_fir, m_weights.size(),
+                                                sig, lo, hi, imax));
+    if (_fit_edge<N>(sig, qwf, lo, hi, imax)) {
+      _monitor_flt_sig( qwf );
+      _trk_hits++;
+      return;
     }
+    _trk_misses++;
   }
-  else {
-    for(unsigned i=0; i<m_sig.shape()[0]; i++) {
-      sigd[i] = double(m_sig[i]);
-      refd[i] = double(m_sig[i]);
+
+  if (_coarse_window(sig, lo, hi)) {
+    const ndarray<const T,1> qwf(_filter_window(*_ws, *_fir, m_weights.size(),
+                                                sig, lo, hi, imax));
+    if (_fit_edge<N>(sig, qwf, lo, hi, imax)) {
+      _monitor_flt_sig( qwf );
+      _crs_hits++;
+      return;
     }
+    _crs_misses++;
   }
 
-  //
-  //  Require projection has a minimum amplitude (else no laser)
-  //
-  bool lcut=true;
-  for(unsigned i=0; i<sigd.shape()[0]; i++)
-    if (sigd[i]>m_proj_cut)
-      lcut=false;
-
-  if (lcut) { _cut[PROJCUT]++; return; }
+  const ndarray<const T,1> qwf(_filter(*_ws, *_fir, m_weights.size(), sig, imax));
 
-  if (nobeam) {
-    _monitor_ref_sig( refd );
-    psalg::rolling_average(ndarray<const double,1>(refd),
-                           m_ref_avg, m_ref_convergence);
-    _cut[NOBEAM]++;
-    return;
-  }
+  _monitor_flt_sig( qwf );
 
-  _monitor_raw_sig( sigd );
+  if (!_fit_edge<N>(sig, qwf, 0, qwf.size(), imax))
+    _trk_valid = false;
+}
 
-  if (m_ref_avg.size()==0) {
-    _cut[NOREF]++;
-    return;
+//
+//  Find the two highest well separated peaks of the filter output over
+//  [lo,hi) and fit the edge.  A window search (lo,hi not the full
+//  output) only succeeds if the peak lies inside the window and its
+//  amplitude and width are plausible for the tracked edge; nothing is
+//  recorded otherwise.
+//
+template<unsigned N, class T>
+bool Fex::_fit_edge(const ndarray<const T,1>& sig,
+                    const ndarray<const T,1>& qwf,
+                    unsigned lo,
+                    unsigned hi,
+                    unsigned imax)
+{
+  unsigned pdim = m_projectX ? 1:0;
+  bool windowed = hi-lo < qwf.size();
+  const T*      q = qwf.data()+lo;
+  unsigned      n = hi-lo;
+
+  const double afrac = 0.50;
+  unsigned* peaks = &_edge_peaks[0];
+  unsigned nfits = m_num_edges ?
+    Filter::peaks(q, n, imax-lo, afrac, _edge_peaks.size(), m_edge_separation, peaks) :
+    Filter::peaks(q, n, imax-lo, afrac, peaks);
+  if (nfits==0) {
+    if (!windowed)
+      _cut[NOFITS]++;
+    return false;
   }
 
-  //
-  //  Divide by the reference
-  //
-  for(unsigned i=0; i<sigd.shape()[0]; i++)
-    sigd[i] = sigd[i]/m_ref_avg[i] - m_ref_offset;
-
-  _monitor_sub_sig( sigd );
-
-  if (m_use_fit) {
-    double chisq = 0.;
-    ndarray<double,1> params = make_ndarray<double>(Fitter::nparams);
-    ndarray<double,1> errors = make_ndarray<double>(Fitter::nparams);
-    ndarray<double,1> qwf = make_ndarray<double>(sigd.size());
+  unsigned ix = peaks[0];
+  double pFit0[3];
+  Filter::parab_fit(q, n, ix, 0.8, pFit0);
+  if (windowed &&
+      (!(pFit0[2]>0) ||
+       q[0]   > afrac*q[ix] ||
+       q[n-1] > afrac*q[ix] ||
+       (_trk_valid && pFit0[0] < m_track_min_amplitude*_trk_ampl) ||
+       pFit0[2] > 0.5*double(n)))
+    return false;
+
+  if (pFit0[2]>0) {
+    //  Positions and widths are in (unbinned) frame pixels.  The edge
+    //  lies half a sample before filter output x+off (the first sample
+    //  past the edge); binned sample k is centred on pixel
+    //  k*bin+(bin-1)/2 of the ROI.  The half pixel of the unbinned
+    //  filter position is kept so that calibrations still apply.
+    double   bin  = m_bin[pdim];
+    //  a fit configuration reaches here only while load is shed
+    double   off  = m_use_fit ? double(m_weights.size()/2) : m_flt_offset;
+    double   x0   = m_sig_roi_lo[pdim]+m_frame_roi[pdim]+(off-0.5)*bin+(bin-1)*0.5+0.5;
+    double   xflt = (pFit0[1]+lo)*bin+x0;
+
+    double  xfltc = 0;
+    for(unsigned i=m_calib_poly.size(); i!=0; )
+      xfltc = xfltc*xflt + m_calib_poly[--i];
+
+    _amplitude = pFit0[0];
+    _flt_position  = xflt;
+    _flt_position_ps  = xfltc;
+    _flt_fwhm      = pFit0[2]*bin;
+    _ref_amplitude = N==1 ? m_ref_avg[ix+lo] : _ref_projected()[ix+lo];
 
-    bool converged = _fitter->fit(sigd, params, errors, chisq);
-
-    for (unsigned i=0; i<qwf.size(); i++) {
-      qwf[i] = Fitter::erf(i, params[0], params[1], params[2], params[3]);
-    }
-
-    _monitor_flt_sig( qwf );
-    if (converged) {
-      double xflt = params[2]+m_sig_roi_lo[pdim]+m_frame_roi[pdim]+m_flt_offset;
-
-      double  xfltc = 0;
-      for(unsigned i=m_calib_poly.size(); i!=0; )
-        xfltc = xfltc*xflt + m_calib_poly[--i];
-
-      _amplitude = params[0];
-      _flt_position = xflt;
-      _flt_position_ps = xfltc;
-      _flt_fwhm = params[1];
-      _ref_amplitude = params[3];
-      _nxt_amplitude = chisq;
-    } else {
-      _cut[NOFITS]++;
-    }
-  } else {
     //
-    //  Apply the digital filter
+    //  next_amplitude remains the second peak of the two-peak search,
+    //  which the separation of the edge list may have suppressed
     //
-    ndarray<double,1> qwf = psalg::finite_impulse_response(m_weights,sigd);
-
-    _monitor_flt_sig( qwf );
+    unsigned        nnxt = nfits;
+    const unsigned* pnxt = peaks;
+    unsigned        pk2[2];
+    if (m_num_edges && m_edge_separation) {
+      nnxt = Filter::peaks(q, n, imax-lo, afrac, pk2);
+      pnxt = pk2;
+    }
+    if (nnxt>1) {
+      double pFit1[3];
+      Filter::parab_fit(q, n, pnxt[1], 0.8, pFit1);
+      if (pFit1[2]>0)
+        _nxt_amplitude = pFit1[0];
+    }
 
     //
-    //  Find the two highest peaks that are well-separated
+    //  Each further edge is refined by its own parabolic fit
     //
-    const double afrac = 0.50;
-    std::list<unsigned> peaks =
-      psalg::find_peaks(qwf, afrac, 2);
-
-    unsigned nfits = peaks.size();
-    if (nfits>0) {
-      unsigned ix = *peaks.begin();
-      ndarray<double,1> pFit0 = psalg::parab_fit(qwf,ix,0.8);
-      if (pFit0[2]>0) {
-        double   xflt = pFit0[1]+m_sig_roi_lo[pdim]+m_frame_roi[pdim]+m_flt_offset;
-
-        double  xfltc = 0;
-        for(unsigned i=m_calib_poly.size(); i!=0; )
-          xfltc = xfltc*xflt + m_calib_poly[--i];
-
-        _amplitude = pFit0[0];
-        _flt_position  = xflt;
-        _flt_position_ps  = xfltc;
-        _flt_fwhm      = pFit0[2];
-        _ref_amplitude = m_ref_avg[ix];
-
-        if (nfits>1) {
-          ndarray<double,1> pFit1 =
-            psalg::parab_fit(qwf,*(++peaks.begin()),0.8);
-          if (pFit1[2]>0)
-            _nxt_amplitude = pFit1[0];
-        }
-      }
+    _nedges = 0;
+    for(unsigned k=0; k<nfits && k<m_num_edges; k++) {
+      double r[3];
+      if (k==0)
+        std::copy(pFit0, pFit0+3, r);
+      else
+        Filter::parab_fit(q, n, peaks[k], 0.8, r);
+      if (!(r[2]>0))
+        continue;
+      Edge& e = _edges[_nedges++];
+      e.position    = (r[1]+lo)*bin+x0;
+      e.position_ps = 0;
+      for(unsigned i=m_calib_poly.size(); i!=0; )
+        e.position_ps = e.position_ps*e.position + m_calib_poly[--i];
+      e.amplitude   = r[0];
+      e.fwhm        = r[2]*bin;
     }
-    else
-      _cut[NOFITS]++;
+
+    _track(pFit0[1]+lo, pFit0[0]);
+
+    if (m_fir_compare)
+      _compare_fir(sig, pFit0[1]+lo);
   }
+  return true;
 }
 
-void Fex::analyze(EventType etype,
-                  const ndarray<const int,2>& signal,
-                  const ndarray<const int,2>& sideband,
-                  const ndarray<const int,2>& reference)
+//
+//  Window of filter outputs around the predicted edge position.  Returns
+//  false if the edge is not tracked or the window covers the output.
+//
+bool Fex::_track_window(unsigned nsignal,
+                        unsigned& lo,
+                        unsigned& hi) const
 {
-  _cut[NCALLS]++;
+  if (!m_track_window || !_trk_valid || m_weights.size() > nsignal)
+    return false;
+
+  double nout = nsignal-m_weights.size()+1;
+  double p    = _trk_pos+_trk_vel;
+  double a    = floor(p)-double(m_track_window);
+  double b    = floor(p)+double(m_track_window)+1;
+  if (a < 0)    a = 0;
+  if (b > nout) b = nout;
+  if (!(b-a > 2) || b-a >= nout)
+    return false;
+
+  lo = unsigned(a);
+  hi = unsigned(b);
+  return true;
+}
 
-  bool nolaser   = (etype == Dark);
+//
+//  Window of filter outputs around the edge located by correlating the
+//  signal decimated by coarse_decimation with the decimated weights.
+//  Returns false if the coarse search is disabled or the window covers
+//  the output.
+//
+template<class T>
+bool Fex::_coarse_window(const ndarray<const T,1>& sig,
+                         unsigned& lo,
+                         unsigned& hi)
+{
+  const unsigned d = m_coarse_decimation;
+  if (!_crs_nweights || m_weights.size() > sig.size())
+    return false;
+
+  ndarray<double,1>& sc = _ws->d1(Workspace::Coarse, sig.size()/d);
+  Filter::decimate(sig.data(), sig.size(), d, sc.data());
+  if (sc.size() < _crs_nweights)
+    return false;
+
+  unsigned imax;
+  ndarray<double,1>& qc = _ws->d1(Workspace::CoarseFiltered, sc.size()-_crs_nweights+1);
+  _fir_coarse->apply(sc.data(), sc.size(), qc.data(), imax);
+
+  unsigned nout = sig.size()-m_weights.size()+1;
+  unsigned c    = imax*d;
+  lo = c > m_coarse_window ? c-m_coarse_window : 0;
+  hi = c+d+m_coarse_window < nout ? c+d+m_coarse_window : nout;
+  return hi > lo+2 && hi-lo < nout;
+}
 
-  bool nobeam    = (etype == Reference);
+//
+//  Alpha-beta update of the tracked edge position (in filter output
+//  samples) and amplitude
+//
+void Fex::_track(double pos,
+                 double amplitude)
+{
+  if (!m_track_window)
+    return;
 
-#ifdef DBUG
-  printf("beam %c  laser %c\n",
-         nobeam ? 'F':'T', nolaser ? 'F':'T');
-#endif
+  if (_trk_valid) {
+    double p = _trk_pos+_trk_vel;
+    double r = pos-p;
+    _trk_pos   = p + m_track_alpha*r;
+    _trk_vel  += m_track_beta*r;
+    _trk_ampl += m_track_alpha*(amplitude-_trk_ampl);
+  }
+  else {
+    _trk_pos   = pos;
+    _trk_vel   = 0;
+    _trk_ampl  = amplitude;
+    _trk_valid = true;
+  }
+}
 
-  if (nolaser) { _cut[NOLASER]++; return; }
+//
+//  Comparison mode: the edge is also found with the double precision
+//  filter and the difference of the positions is accumulated
+//
+void Fex::_compare_fir(const ndarray<const float,1>& sig,
+                       double pos)
+{
+  ndarray<double,1>& sigd = _ws->d1(Workspace::SigProjCmp, sig.size());
+  for(unsigned i=0; i<sig.size(); i++)
+    sigd[i] = sig[i];
+  _compare_fir(ndarray<const double,1>(sigd), pos);
+}
 
-  if (!signal.size()) { _cut[FRAMESIZE]++; return; }
+void Fex::_compare_fir(const ndarray<const double,1>& sig,
+                       double pos)
+{
+  unsigned imax;
+  const ndarray<double,1>& q = _filter(*_ws, *_fir_cmp, m_weights.size(), sig, imax,
+                                       Workspace::FilteredCmp);
+  unsigned peaks[2];
+  double   r[3] = { 0, 0, 0 };
+  if (Filter::peaks(q.data(), q.size(), imax, 0.50, peaks))
+    Filter::parab_fit(q.data(), q.size(), peaks[0], 0.8, r);
+  if (!(r[2]>0))
+    return;
 
-  unsigned pdim = m_projectX ? 1:0;
+  double d = fabs(pos-r[1])*m_bin[m_projectX ? 1:0];
+  _cmp_n++;
+  _cmp_sum2 += d*d;
+  if (d > _cmp_max)
+    _cmp_max = d;
+}
+
+//
+//  Stages that differ between projected and full regions
+//
+void Fex::_store(const ndarray<const int,1>& signal,
+                 const ndarray<const int,1>& sideband,
+                 const ndarray<const int,1>& reference)
+{
+  m_sig = signal;
+  m_sb  = sideband;
+  m_ref = reference;
+}
+
+void Fex::_store(const ndarray<const int,2>& signal,
+                 const ndarray<const int,2>& sideband,
+                 const ndarray<const int,2>& reference)
+{
   m_sig_full = signal;
   m_sb_full  = sideband;
   m_ref_full = reference;
+}
 
-  ndarray<double,2> sigd_full = make_ndarray<double>(m_sig_full.shape()[0],m_sig_full.shape()[1]);
-  ndarray<double,2> refd_full = make_ndarray<double>(m_sig_full.shape()[0],m_sig_full.shape()[1]);
-
-  //
-  //  Calculate sum of signal roi and store
-  //
-  _sig_roi_sum = sum_array(m_sig_full);
-
-  //
-  //  Correct projection for common mode found in sideband
-  //
-  if (m_sb_full.size()) {
-    psalg::rolling_average(m_sb_full, m_sb_avg_full, m_sb_convergence);
-
-    ndarray<const double,2> sbc = psalg::commonModeLROE(m_sb_full, m_sb_avg_full);
-
-    for(unsigned i=0; i<m_sig_full.shape()[0]; i++) {
-      for(unsigned j=0; j<m_sig_full.shape()[1]; j++) {
-        sigd_full(i,j) = double(m_sig_full(i,j))-sbc(i,j);
-        refd_full(i,j) = double(m_ref_full(i,j))-sbc(i,j);
-      }
-    }
-  }
-  else {
-    for(unsigned i=0; i<m_sig_full.shape()[0]; i++) {
-      for(unsigned j=0; j<m_sig_full.shape()[1]; j++) {
-        sigd_full(i,j) = double(m_sig_full(i,j));
-        refd_full(i,j) = double(m_sig_full(i,j));
-      }
-    }
-  }
-
-  //
-  //  Require projection has a minimum amplitude (else no laser)
-  //
-  bool lcut=true;
-  for(unsigned i=0; i<sigd_full.shape()[0]; i++) {
-    for(unsigned j=0; j<sigd_full.shape()[1]; j++) {
-    if (sigd_full(i,j)>m_proj_cut)
-      lcut=false;
-    }
+//
+//  The sideband average is updated and the common mode correction taken
+//  against it in one pass; the first sideband initializes the average.
+//
+const ndarray<double,1>& Fex::_sideband(const ndarray<const int,1>& sb)
+{
+  ndarray<double,1>& r = _ws->d1(Workspace::SbCorr, sb.shape()[0]);
+  if (m_sb_avg.size()!=sb.size()) {
+    psalg::rolling_average(sb, m_sb_avg, m_sb_convergence);
+    Filter::lroe(sb.data(), m_sb_avg.data(), sb.shape()[0], r.data());
   }
+  else
+    Filter::rolling_lroe(sb.data(), m_sb_avg.data(), m_sb_convergence,
+                         sb.shape()[0], r.data());
+  return r;
+}
 
-  if (lcut) { _cut[PROJCUT]++; return; }
-
-  ndarray<double,1> sigd = psalg::project(sigd_full, 0.0, pdim);
-  ndarray<double,1> refd = psalg::project(refd_full, 0.0, pdim);
-
-  if (nobeam) {
-    _monitor_ref_sig( refd );
-    _monitor_ref_sig_full( refd_full );
-    psalg::rolling_average(ndarray<const double,2>(refd_full),
-                           m_ref_avg_full, m_ref_convergence);
-    _cut[NOBEAM]++;
-    return;
+//
+//  The full region common mode is kept as the four group means of each
+//  row; the streamed signal pipeline applies them row by row and only
+//  the other pipelines expand them to the region.
+//
+const ndarray<double,2>& Fex::_sideband_means(const ndarray<const int,2>& sb)
+{
+  ndarray<double,2>& r = _ws->d2(Workspace::SbMeans, sb.shape()[0], 4);
+  if (m_sb_avg_full.size()!=sb.size()) {
+    psalg::rolling_average(sb, m_sb_avg_full, m_sb_convergence);
+    Filter::lroe_means(sb.data(), m_sb_avg_full.data(),
+                       sb.shape()[0], sb.shape()[1], r.data());
   }
+  else
+    Filter::rolling_lroe_means(sb.data(), m_sb_avg_full.data(), m_sb_convergence,
+                               sb.shape()[0], sb.shape()[1], r.data());
+  return r;
+}
 
-  _monitor_raw_sig( sigd );
-  _monitor_raw_sig_full( sigd_full );
-
-  if (m_ref_avg_full.size()==0) {
-    _cut[NOREF]++;
-    return;
-  }
+const ndarray<double,2>& Fex::_sideband(const ndarray<const int,2>& sb)
+{
+  const ndarray<double,2>& m = _sideband_means(sb);
+  ndarray<double,2>& r = _ws->d2(Workspace::SbCorr, sb.shape()[0], sb.shape()[1]);
+  Filter::lroe_expand(m.data(), sb.shape()[0], sb.shape()[1], r.data());
+  return r;
+}
 
-  //
-  //  Divide by the reference
-  //
-  for(unsigned i=0; i<sigd_full.shape()[0]; i++)
-    for(unsigned j=0; j<sigd_full.shape()[1]; j++)
-      sigd_full(i,j) = sigd_full(i,j)/m_ref_avg_full(i,j) - m_ref_offset;
+void Fex::_reference(const ndarray<double,1>& refd,
+                     const ndarray<double,1>& )
+{
+  _monitor_ref_sig( refd );
+  psalg::rolling_average(ndarray<const double,1>(refd),
+                         m_ref_avg, m_ref_convergence);
+  ref_changed();
+}
 
-  sigd = psalg::project(sigd_full, 0.0, pdim);
+void Fex::_reference(const ndarray<double,2>& refd,
+                     const ndarray<double,1>& refp)
+{
+  _monitor_ref_sig( refp );
+  _monitor_ref_sig_full( refd );
+  psalg::rolling_average(ndarray<const double,2>(refd),
+                         m_ref_avg_full, m_ref_convergence);
+  ref_changed();
+}
 
-  _monitor_sub_sig( sigd );
-  _monitor_sub_sig_full( sigd_full );
+void Fex::_monitor_raw(const ndarray<double,1>& sigp,
+                       const ndarray<double,1>& )
+{
+  _monitor_raw_sig( sigp );
+}
 
-  if (m_use_fit) {
-    double chisq = 0.;
-    ndarray<double,1> params = make_ndarray<double>(Fitter::nparams);
-    ndarray<double,1> errors = make_ndarray<double>(Fitter::nparams);
-    ndarray<double,1> qwf = make_ndarray<double>(sigd.size());
+void Fex::_monitor_raw(const ndarray<double,1>& sigp,
+                       const ndarray<double,2>& sigd)
+{
+  _monitor_raw_sig( sigp );
+  _monitor_raw_sig_full( sigd );
+}
 
-    bool converged = _fitter->fit(sigd, params, errors, chisq);
+template<class T>
+void Fex::_monitor_sub(const ndarray<const T,1>& sigp,
+                       const ndarray<double,1>& )
+{
+  _monitor_sub_sig( sigp );
+}
 
-    for (unsigned i=0; i<qwf.size(); i++) {
-      qwf[i] = Fitter::erf(i, params[0], params[1], params[2], params[3]);
-    }
+template<class T>
+void Fex::_monitor_sub(const ndarray<const T,1>& sigp,
+                       const ndarray<double,2>& sigd)
+{
+  _monitor_sub_sig_full( sigd );
+  _monitor_sub_sig( sigp );
+}
 
-    _monitor_flt_sig( qwf );
-    if (converged) {
-      double xflt = params[2]+m_sig_roi_lo[pdim]+m_frame_roi[pdim]+m_flt_offset;
+bool Fex::_normalize(ndarray<double,1>& sigd)
+{
+  if (m_ref_avg.size()==0)
+    return false;
+  _divide_reference(sigd.data(), _ref_reciprocal().data(), sigd.size(), _ref_offset());
+  return true;
+}
 
-      double  xfltc = 0;
-      for(unsigned i=m_calib_poly.size(); i!=0; )
-        xfltc = xfltc*xflt + m_calib_poly[--i];
+bool Fex::_normalize(ndarray<double,2>& sigd)
+{
+  if (m_ref_avg_full.size()==0)
+    return false;
+  _divide_reference(sigd.data(), _ref_reciprocal_full().data(), sigd.size(), _ref_offset());
+  return true;
+}
 
-      _amplitude = params[0];
-      _flt_position = xflt;
-      _flt_position_ps = xfltc;
-      _flt_fwhm = params[1];
-      _ref_amplitude = params[3];
-      _nxt_amplitude = chisq;
-    } else {
-      _cut[NOFITS]++;
-    }
-  } else {
-    //
-    //  Apply the digital filter
-    //
-    ndarray<double,1> qwf = psalg::finite_impulse_response(m_weights,sigd);
+bool Fex::_single() const
+{
+  return _fir->precision()==Filter::Single && _fir->method()==Filter::Direct;
+}
 
-    _monitor_flt_sig( qwf );
+//
+//  Normalization to a single precision projection
+//
+bool Fex::_normalize(ndarray<double,1>& sigd, ndarray<float,1>& sig)
+{
+  if (m_ref_avg.size()==0)
+    return false;
+  _divide_reference(sigd.data(), _ref_reciprocal().data(), sigd.size(), _ref_offset(),
+                    sig.data());
+  return true;
+}
 
-    //
-    //  Find the two highest peaks that are well-separated
-    //
-    const double afrac = 0.50;
-    std::list<unsigned> peaks =
-      psalg::find_peaks(qwf, afrac, 2);
-
-    unsigned nfits = peaks.size();
-    if (nfits>0) {
-      unsigned ix = *peaks.begin();
-      ndarray<double,1> pFit0 = psalg::parab_fit(qwf,ix,0.8);
-      if (pFit0[2]>0) {
-        double   xflt = pFit0[1]+m_sig_roi_lo[pdim]+m_frame_roi[pdim]+m_flt_offset;
-
-        double  xfltc = 0;
-        for(unsigned i=m_calib_poly.size(); i!=0; )
-          xfltc = xfltc*xflt + m_calib_poly[--i];
-
-        _amplitude = pFit0[0];
-        _flt_position  = xflt;
-        _flt_position_ps  = xfltc;
-        _flt_fwhm      = pFit0[2];
-        _ref_amplitude = psalg::project(m_ref_avg_full,0.0,pdim)[ix];
-
-        if (nfits>1) {
-          ndarray<double,1> pFit1 =
-            psalg::parab_fit(qwf,*(++peaks.begin()),0.8);
-          if (pFit1[2]>0)
-            _nxt_amplitude = pFit1[0];
-        }
-      }
-    }
-    else
-      _cut[NOFITS]++;
-  }
+bool Fex::_normalize(ndarray<double,2>& sigd, ndarray<float,1>& sig)
+{
+  if (!_normalize(sigd))
+    return false;
+  Projector::project(sigd.data(), sigd.shape()[0], sigd.shape()[1],
+                     m_projectX ? 1:0, sig.data());
+  return true;
 }
 
-ndarray<double,1> load_reference(unsigned key, unsigned sz, const char* dir)
+
+ndarray<double,1> load_reference(const std::string& fname, unsigned sz)
 {
-  char buff[PATH_MAX];
+  const char* buff = fname.c_str();
   ndarray<double,1> m_ref_avg;
 
   // Load reference
-  { sprintf(buff,"%s/timetool.ref.%08x", dir, key);
-    std::vector<double> r;
+  { std::vector<double> r;
     FILE* rf = fopen(buff,"r");
     if (rf) {
       float rv;
@@ -1794,14 +2929,13 @@ ndarray<double,1> load_reference(unsigned key, unsigned sz, const char* dir)
   return m_ref_avg;
 }
 
-ndarray<double,2> load_reference(unsigned key, unsigned row_sz, unsigned col_sz, const char* dir)
+ndarray<double,2> load_reference(const std::string& fname, unsigned row_sz, unsigned col_sz)
 {
-  char buff[PATH_MAX];
+  const char* buff = fname.c_str();
   ndarray<double,2> m_ref_avg;
 
   // Load reference
-  { sprintf(buff,"%s/timetool.ref.%08x", dir, key);
-    std::vector<double> r;
+  { std::vector<double> r;
     FILE* rf = fopen(buff,"r");
     if (rf) {
       float rv;
@@ -1823,20 +2957,66 @@ ndarray<double,2> load_reference(unsigned key, unsigned row_sz, unsigned col_sz,
   return m_ref_avg;
 }
 
-double sum_array(const ndarray<const int,1>& data)
+ndarray<double,2> load_dark(const std::string& fname, unsigned row_sz, unsigned col_sz)
 {
-  double result = 0.0;
-  for(const int* a=data.begin(); a!=data.end(); a++) {
-    result += *a;
+  const char* buff = fname.c_str();
+  ndarray<double,2> m_dark_avg;
+
+  // Load pedestal map
+  { std::vector<double> r;
+    FILE* rf = fopen(buff,"r");
+    if (rf) {
+      float rv;
+      unsigned nbad = 0;
+      while( fscanf(rf,"%f",&rv)>0 ) {
+        if (!(rv >= 0 && rv < 65536))
+          nbad++;
+        r.push_back(rv);
+      }
+      if (!feof(rf)) {
+        printf("Pedestal in %s is unreadable after %zu values\n",
+               buff, r.size());
+      }
+      else if (nbad) {
+        printf("Pedestal in %s has %u values out of range\n",
+               buff, nbad);
+      }
+      else if (r.size()==(row_sz*col_sz)) {
+        m_dark_avg = make_ndarray<double>(row_sz, col_sz);
+        for(unsigned i=0; i<row_sz; i++)
+          for(unsigned j=0; j<col_sz; j++)
+            m_dark_avg(i,j) = r[col_sz*i+j];
+      }
+      else {
+        printf("Pedestal in %s size %zu does not match [%u]\n",
+               buff, r.size(), row_sz*col_sz);
+      }
+      fclose(rf);
+    }
   }
-  return result;
+  return m_dark_avg;
 }
 
-double sum_array(const ndarray<const int,2>& data)
+std::vector<std::string> load_mask(const std::string& fname)
 {
-  double result = 0.0;
-  for(const int* a=data.begin(); a!=data.end(); a++) {
-    result += *a;
+  const char* buff = fname.c_str();
+  std::vector<std::string> m_mask;
+
+  // Load bitmap of masked pixels
+  { FILE* mf = fopen(buff,"r");
+    if (mf) {
+      char* line = 0;
+      size_t sz = 0;
+      ssize_t n;
+      while( (n=getline(&line,&sz,mf))>=0 ) {
+        while(n>0 && (line[n-1]=='\n' || line[n-1]=='\r'))
+          n--;
+        m_mask.push_back(std::string(line,n));
+      }
+      free(line);
+      fclose(mf);
+      printf("Pixel mask loaded from %s [%zu rows]\n", buff, m_mask.size());
+    }
   }
-  return result;
+  return m_mask;
 }
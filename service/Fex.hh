@@ -20,6 +20,9 @@ namespace Pds {
 namespace TimeTool {
   const char* default_file_path();
   class Fitter;
+  class Workspace;
+  class Filter;
+  class Mask;
   class Fex {
   public:
     Fex(const char* fname="timetool.input",
@@ -51,6 +54,42 @@ namespace TimeTool {
                  const ndarray<const Pds::EvrData::FIFOEvent,1>& evr_fifo,
                  const Pds::Lusi::IpmFexV1* ipm);
 
+    //  Edges of the multiple edge detector (num_edges) in order of
+    //  amplitude; the first is the filtered position
+    struct Edge { double position, position_ps, amplitude, fwhm; };
+
+    //
+    //  Results of a batch of frames for one ROI, one element per frame.
+    //  cut is the reason a frame gave no edge, in the order of the
+    //  summary counters.  The edge list (num_edges) of frame i is
+    //  edges[edge_index[i]] to edges[edge_index[i+1]-1].
+    //
+    enum CutReason { Accepted, NoLaser, FrameSize, ProjCut,
+                     NoBeam, NoRef, NoFits };
+    struct RoiResults {
+      std::vector<double>   position;
+      std::vector<double>   position_ps;
+      std::vector<double>   fwhm;
+      std::vector<double>   amplitude;
+      std::vector<double>   next_amplitude;
+      std::vector<double>   ref_amplitude;
+      std::vector<double>   sig_roi_sum;
+      std::vector<unsigned> cut;
+      std::vector<unsigned> edge_index;
+      std::vector<Edge>     edges;
+    };
+    //  Results of the primary ROI and of each ROI channel
+    struct BatchResults : RoiResults {
+      std::vector<RoiResults> channels;
+    };
+    //  Analysis of n frames in order, identical to n calls of analyze()
+    //  each preceded by reset().  ipm may be NULL.
+    void analyze_batch(const ndarray<const uint16_t,2>* frames,
+                       const ndarray<const Pds::EvrData::FIFOEvent,1>* evr_fifos,
+                       const Pds::Lusi::IpmFexV1* const* ipms,
+                       unsigned n,
+                       BatchResults& results);
+
     enum EventType { Dark, Reference, Signal };
     void analyze(EventType,
 		 const ndarray<const int,1>& signal,
@@ -77,11 +116,29 @@ namespace TimeTool {
     double next_amplitude   () const { return _nxt_amplitude; }
     double ref_amplitude    () const { return _ref_amplitude; }
     double sig_roi_sum      () const { return _sig_roi_sum; }
+    unsigned    nedges      () const { return _nedges; }
+    const Edge& edge        (unsigned i) const { return _edges[i]; }
     bool   status   () const { return _flt_fwhm>0; }
   public:
     bool   use_full_roi     () const { return m_use_full_roi; }
     bool   write_image      () const { return _write_image; }
     bool   write_projections() const { return _write_projections; }
+    //  Subclasses that modify m_ref_avg or m_ref_avg_full directly must
+    //  call this so that quantities derived from the reference are updated
+    void   ref_changed      () { m_ref_gen++; }
+    //  Overload policy: while load is shed an existing reference is not
+    //  updated and a fit is replaced by the FIR (if weights are
+    //  configured) until the application resumes.  degraded() is set
+    //  for events whose processing was reduced.
+    void   shed             (bool);
+    bool   shedding         () const { return _shed; }
+    bool   degraded         () const { return _degraded; }
+    //  Workspace allocations since configure (of this Fex and its
+    //  channels); none are expected once the first frame is analysed
+    unsigned allocations    () const;
+    //  Bytes of the workspace buffers used since reset() (of this Fex
+    //  and its channels), the scratch working set of the last event
+    unsigned long working_set() const;
 //     const uint32_t* signal_wf   () const { return sig; }
 //     const uint32_t* sideband_wf () const { return sb; }
 //     const uint32_t* reference_wf() const { return ref; }
@@ -90,16 +147,24 @@ namespace TimeTool {
     virtual void _monitor_ref_sig (const ndarray<const double,1>&) {}
     virtual void _monitor_sub_sig (const ndarray<const double,1>&) {}
     virtual void _monitor_flt_sig (const ndarray<const double,1>&) {}
+    //  Projections of the single precision filter (use_float)
+    virtual void _monitor_sub_sig (const ndarray<const float,1>&) {}
+    virtual void _monitor_flt_sig (const ndarray<const float,1>&) {}
 
     virtual void _monitor_raw_sig_full (const ndarray<const double,2>&) {}
     virtual void _monitor_ref_sig_full (const ndarray<const double,2>&) {}
     virtual void _monitor_sub_sig_full (const ndarray<const double,2>&) {}
     virtual void _monitor_flt_sig_full (const ndarray<const double,2>&) {}
+    //  True if the full region monitors are used, so that the corrected
+    //  signal region is made for every event
+    virtual bool monitors_full() const { return false; }
   public:
     static const Pds::TimeTool::ConfigV3* config(const char* fname="timetool.input");
   public:
     string   _fname;
     string   _ref_path;
+    unsigned m_channel;      // ROI channel index (0 is the primary ROI)
+    bool     m_build_channels; // configure() builds the ROI channels
 
     unsigned m_get_key;
     string   m_put_key;
@@ -118,6 +183,22 @@ namespace TimeTool {
 
     bool     m_use_full_roi;   // use full roi region instead of projecting
     bool     m_use_fit;        // use a fit for the edge instead of an FIR
+    unsigned m_fir_method;     // FIR implementation (Filter::Method)
+    bool     m_use_float;      // run the direct FIR in single precision
+    bool     m_use_fixed;      // run the direct FIR in fixed point
+    bool     m_fir_compare;    // compare edges found by the FIR with double precision
+    unsigned m_track_window;   // half width of the edge tracking window (0 disables)
+    double   m_track_alpha;    // alpha-beta tracking gains
+    double   m_track_beta;
+    double   m_track_min_amplitude; // window edge amplitude relative to the tracked amplitude
+    unsigned m_coarse_decimation; // decimation of the coarse edge search (0 disables)
+    unsigned m_coarse_window;  // half width of the window searched at full resolution
+    unsigned m_num_edges;      // edges reported by the multiple edge detector (0 disables)
+    unsigned m_edge_separation; // minimum separation of the edges in filter samples
+    bool     m_adaptive_roi;   // narrow the signal ROI to the illuminated lines
+    double   m_adaptive_roi_threshold; // line intensity relative to the brightest line
+    unsigned m_adaptive_roi_margin;    // lines kept beyond the illuminated ones
+    bool     m_use_dark;       // learn a per-pixel pedestal from no-laser frames
 
     unsigned m_sig_roi_lo[2];  // image sideband is projected within ROI
     unsigned m_sig_roi_hi[2];  // image sideband is projected within ROI
@@ -130,11 +211,14 @@ namespace TimeTool {
 
     unsigned m_frame_roi[2];  // frame data is an ROI
 
+    unsigned m_bin[2];        // full roi binning (rows, columns)
+
     bool     m_use_sb_roi;
     bool     m_use_ref_roi;
 
     double   m_sb_convergence ; // rolling average fraction (1/N)
     double   m_ref_convergence; // rolling average fraction (1/N)
+    double   m_dark_convergence; // rolling average fraction (1/N)
 
     unsigned m_fit_max_iterations;    // maximum number of iterations for fitting
     double   m_fit_weights_factor;    // scale factor for deriving weights for fitting
@@ -150,6 +234,7 @@ namespace TimeTool {
 
     ndarray<double,2> m_ref_avg_full; // accumulated full reference
     ndarray<double,2> m_sb_avg_full;  // averaged full sideband
+    unsigned          m_ref_gen;      // incremented when the reference changes
 
     ndarray<const int,1> m_sig;      // signal region projection
     ndarray<const int,1> m_sb;       // sideband region projection
@@ -159,7 +244,19 @@ namespace TimeTool {
     ndarray<const int,2> m_sb_full;  // full sideband region - spatial only
     ndarray<const int,2> m_ref_full; // full reference region - spatial only
 
+    std::vector<Fex*> m_channels;    // further ROIs analysed in the same frame pass
+    std::vector<std::string> m_channel_files; // their configuration files ("channels")
+
     unsigned m_pedestal;
+    int      m_channel_pedestal; // pedestal of a ROI channel ("pedestal"), else
+                                 //   (<0) the frame pedestal of the primary
+
+    unsigned          m_dark_lo[2];   // frame region of the pedestal map
+    unsigned          m_dark_hi[2];   //   (bounding box of the ROIs)
+    ndarray<double,2> m_dark_avg;     // accumulated per-pixel pedestal
+    unsigned          m_dark_gen;     // incremented when the pedestal changes
+
+    std::vector<std::string> m_mask;  // bitmap of masked frame pixels
 
     bool     _write_image;
     bool     _write_projections;
@@ -178,6 +275,138 @@ namespace TimeTool {
     std::vector<unsigned> _cut;
 
     Fitter* _fitter;
+    Workspace* _ws;
+    Filter*    _fir;
+    Filter*    _fir_cmp;   // double precision FIR of the comparison mode
+    Filter*    _fir_coarse; // FIR of the decimated signal
+    Mask*      _sig_mask;
+    Mask*      _sb_mask;
+    Mask*      _ref_mask;
+  private:
+    typedef void (Fex::*FramePipeline)(const ndarray<const uint16_t,2>&, bool);
+    typedef void (Fex::*ChannelPipeline)(bool, int);
+    bool _accept_frame(const ndarray<const uint16_t,2>& frame, bool nolaser);
+    //  Record the results of the last frame as element i; cut holds the
+    //  summary counters before the frame
+    void _batch_result(RoiResults& r, unsigned i, const unsigned* cut) const;
+    template<bool full, bool sb, bool ref, bool fit>
+    void _analyze_frame(const ndarray<const uint16_t,2>& frame, bool nobeam);
+    void _analyze_channels(const ndarray<const uint16_t,2>& frame, bool nobeam);
+    template<bool sb, bool ref, bool fit>
+    void _analyze_projected(bool nobeam, int smax);
+    template<unsigned N>
+    void _analyze_input(EventType,
+                        const ndarray<const int,N>& signal,
+                        const ndarray<const int,N>& sideband,
+                        const ndarray<const int,N>& reference);
+    template<unsigned N, bool ref, bool fit>
+    void _analyze(bool nobeam,
+                  ndarray<double,N>& sigd,
+                  const ndarray<double,N>& refd);
+    template<bool ref, bool fit>
+    void _analyze_streamed(const ndarray<const int,2>& signal,
+                           const ndarray<const int,2>& reference,
+                           const double* sideband);
+    template<unsigned N, bool fit>
+    void _find_edge(const ndarray<const double,1>& sig);
+    template<unsigned N, class T>
+    void _filter_edge(const ndarray<const T,1>& sig);
+    template<unsigned N, class T>
+    bool _fit_edge(const ndarray<const T,1>& sig,
+                   const ndarray<const T,1>& filtered,
+                   unsigned lo, unsigned hi, unsigned imax);
+    bool _track_window(unsigned nsignal, unsigned& lo, unsigned& hi) const;
+    template<class T>
+    bool _coarse_window(const ndarray<const T,1>& sig, unsigned& lo, unsigned& hi);
+    void _track       (double position, double amplitude);
+    void _compare_fir(const ndarray<const double,1>& sig, double pos);
+    void _compare_fir(const ndarray<const float,1>& sig, double pos);
+    //  The filter runs in single precision on a float projection
+    bool _single     () const;
+    void _store      (const ndarray<const int,1>&,
+                      const ndarray<const int,1>&,
+                      const ndarray<const int,1>&);
+    void _store      (const ndarray<const int,2>&,
+                      const ndarray<const int,2>&,
+                      const ndarray<const int,2>&);
+    const ndarray<double,1>& _sideband(const ndarray<const int,1>&);
+    const ndarray<double,2>& _sideband(const ndarray<const int,2>&);
+    const ndarray<double,2>& _sideband_means(const ndarray<const int,2>&);
+    void _reference  (const ndarray<double,1>&, const ndarray<double,1>&);
+    void _reference  (const ndarray<double,2>&, const ndarray<double,1>&);
+    void _monitor_raw(const ndarray<double,1>&, const ndarray<double,1>&);
+    void _monitor_raw(const ndarray<double,1>&, const ndarray<double,2>&);
+    template<class T>
+    void _monitor_sub(const ndarray<const T,1>&, const ndarray<double,1>&);
+    template<class T>
+    void _monitor_sub(const ndarray<const T,1>&, const ndarray<double,2>&);
+    bool _normalize  (ndarray<double,1>&);
+    bool _normalize  (ndarray<double,2>&);
+    bool _normalize  (ndarray<double,1>&, ndarray<float,1>&);
+    bool _normalize  (ndarray<double,2>&, ndarray<float,1>&);
+    void _validate_roi(const ndarray<const uint16_t,2>& frame);
+    void _dark_region ();
+    void _update_dark (const ndarray<const uint16_t,2>& frame);
+    bool _dark_pedestal();
+    void _compile_mask ();
+    void _adapt_roi    (const ndarray<const uint16_t,2>& frame);
+    double _extract_roi(const ndarray<const uint16_t,2>& frame,
+                        const unsigned* lo,
+                        const unsigned* hi,
+                        const int*      pedestal_map,
+                        int*            roi,
+                        int&            vmax);
+    //  Extent of an ROI along dimension i after binning
+    unsigned _binned(const unsigned* lo, const unsigned* hi, unsigned i) const
+    { return (hi[i]-lo[i]+1)/m_bin[i]; }
+    double _project_roi(const ndarray<const uint16_t,2>& frame,
+                        const unsigned* lo,
+                        const unsigned* hi,
+                        const Mask&     mask,
+                        const int*      pedestal_proj,
+                        int*            proj,
+                        int&            vmax);
+  private:
+    FramePipeline   _frame_pipeline;
+    ChannelPipeline _channel_pipeline;  // projections made by the primary ROI
+    unsigned      _frame_shape[2];  // frame shape the ROIs are valid for
+    bool          _shed;            // load is shed
+    bool          _degraded;        // processing of this event was reduced
+  private:
+    void _configure_workspace();
+    void _select_pipelines();
+    //  The edge is found with a fit (not shed for the FIR)
+    bool _fit() const { return m_use_fit && !(_shed && m_weights.size()); }
+    //  Offset subtracted after dividing by the reference; the FIR value
+    //  while a fit is shed
+    double _ref_offset() const { return m_use_fit && !_fit() ? 1.0 : m_ref_offset; }
+    std::string _file_name(const char* type) const;
+    const ndarray<double,1>& _ref_reciprocal();
+    const ndarray<double,2>& _ref_reciprocal_full();
+    const ndarray<double,1>& _ref_projected();
+    bool     _trk_valid;         // an edge is being tracked
+    double   _trk_pos;           //   position in filter output samples
+    double   _trk_vel;           //   change of position per event
+    double   _trk_ampl;          //   amplitude
+    unsigned _trk_hits;          // edges found within the tracking window
+    unsigned _trk_misses;        //   and by the fallback search
+    unsigned _crs_nweights;      // decimated weights of the coarse search (0 disables)
+    unsigned _crs_hits;          // edges found within the coarse search window
+    unsigned _crs_misses;        //   and by the fallback search
+    std::vector<unsigned> _edge_peaks; // peak heap of the edge detector
+    std::vector<Edge>     _edges;      // edges of the multiple edge detector
+    unsigned              _nedges;
+    unsigned _roi_outer[2];      // configured signal ROI across the projection
+    unsigned _sb_outer [2];      //   and sideband ROI
+    ndarray<double,1> _roi_profile; // averaged line intensity of the configured ROI
+    unsigned _roi_changes;       // adaptive ROI changes
+    unsigned _cmp_n;             // events compared with the double precision FIR
+    double   _cmp_sum2;          //   sum of squared edge differences
+    double   _cmp_max;           //   largest edge difference
+    unsigned _ref_inv_gen;       // reference generation of the reciprocal
+    unsigned _ref_inv_full_gen;  // reference generation of the full reciprocal
+    unsigned _ref_proj_gen;      // reference generation of the full projection
+    unsigned _dark_ws_gen;       // pedestal generation of the ROI pedestals
   };
 
 };
@@ -0,0 +1,911 @@
+#include "Filter.hh"
+
+#include <gsl/gsl_fft_real.h>
+#include <gsl/gsl_fft_halfcomplex.h>
+
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#if defined(__GNUC__) && (__GNUC__ >= 5) && (defined(__x86_64__) || defined(__i386__))
+#define TT_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace TimeTool;
+
+//
+//  Relative cost of one FFT block of size n in units of one direct
+//  multiply-add: a forward and inverse real transform plus the
+//  spectrum product and copies
+//
+static double _fft_cost(unsigned n)
+{
+  return 2*2.5*double(n)*log2(double(n)) + 2*double(n);
+}
+
+//
+//  Single precision correlation kernels.  Each computes the leading
+//  outputs in blocks of two vectors and returns the number of outputs
+//  produced; the remainder is left to the scalar loop.  Every output
+//  accumulates the weights in the same order as the scalar loop (no
+//  fused multiply-add), so all kernels give identical results.
+//
+typedef unsigned (*fir_float_fn)(const float*, unsigned, const float*, unsigned, float*);
+
+static unsigned _fir_float_scalar(const float*, unsigned, const float*, unsigned, float*)
+{
+  return 0;
+}
+
+#ifdef TT_SIMD
+
+__attribute__((target("avx")))
+static unsigned _fir_float_avx(const float* w, unsigned nw,
+                               const float* s, unsigned n,
+                               float* out)
+{
+  unsigned i=0;
+  for(; i+16<=n; i+=16) {
+    const float* p = s+i;
+    __m256 a0 = _mm256_setzero_ps();
+    __m256 a1 = _mm256_setzero_ps();
+    for(unsigned j=0; j<nw; j++) {
+      __m256 wj = _mm256_broadcast_ss(w+j);
+      a0 = _mm256_add_ps(a0, _mm256_mul_ps(_mm256_loadu_ps(p+j  ), wj));
+      a1 = _mm256_add_ps(a1, _mm256_mul_ps(_mm256_loadu_ps(p+j+8), wj));
+    }
+    _mm256_storeu_ps(out+i  , a0);
+    _mm256_storeu_ps(out+i+8, a1);
+  }
+  return i;
+}
+
+__attribute__((target("sse2")))
+static unsigned _fir_float_sse(const float* w, unsigned nw,
+                               const float* s, unsigned n,
+                               float* out)
+{
+  unsigned i=0;
+  for(; i+8<=n; i+=8) {
+    const float* p = s+i;
+    __m128 a0 = _mm_setzero_ps();
+    __m128 a1 = _mm_setzero_ps();
+    for(unsigned j=0; j<nw; j++) {
+      __m128 wj = _mm_set1_ps(w[j]);
+      a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(p+j  ), wj));
+      a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(p+j+4), wj));
+    }
+    _mm_storeu_ps(out+i  , a0);
+    _mm_storeu_ps(out+i+4, a1);
+  }
+  return i;
+}
+
+static fir_float_fn _select_fir_float()
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx" )) return _fir_float_avx;
+  if (__builtin_cpu_supports("sse2")) return _fir_float_sse;
+  return _fir_float_scalar;
+}
+
+#else
+
+static fir_float_fn _select_fir_float() { return _fir_float_scalar; }
+
+#endif
+
+static const fir_float_fn _fir_float = _select_fir_float();
+
+//
+//  Fixed point correlation kernels.  Each 32-bit multiply-add of a
+//  sample pair with a weight pair sums two products, so the kernels
+//  compute the leading outputs in blocks of two vectors and return the
+//  number produced.  Integer sums are exact, so all kernels give
+//  identical results.
+//
+typedef unsigned (*fir_fixed_fn)(const int32_t*, unsigned, const int32_t*, unsigned, int32_t*);
+
+static unsigned _fir_fixed_scalar(const int32_t*, unsigned, const int32_t*, unsigned, int32_t*)
+{
+  return 0;
+}
+
+#ifdef TT_SIMD
+
+__attribute__((target("avx2")))
+static unsigned _fir_fixed_avx2(const int32_t* w, unsigned np,
+                                const int32_t* s, unsigned n,
+                                int32_t* out)
+{
+  unsigned i=0;
+  for(; i+16<=n; i+=16) {
+    const int32_t* p = s+i;
+    __m256i a0 = _mm256_setzero_si256();
+    __m256i a1 = _mm256_setzero_si256();
+    for(unsigned j=0; j<np; j++) {
+      __m256i wj = _mm256_set1_epi32(w[j]);
+      a0 = _mm256_add_epi32(a0, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(p+2*j  )), wj));
+      a1 = _mm256_add_epi32(a1, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(p+2*j+8)), wj));
+    }
+    _mm256_storeu_si256((__m256i*)(out+i  ), a0);
+    _mm256_storeu_si256((__m256i*)(out+i+8), a1);
+  }
+  return i;
+}
+
+__attribute__((target("sse2")))
+static unsigned _fir_fixed_sse(const int32_t* w, unsigned np,
+                               const int32_t* s, unsigned n,
+                               int32_t* out)
+{
+  unsigned i=0;
+  for(; i+8<=n; i+=8) {
+    const int32_t* p = s+i;
+    __m128i a0 = _mm_setzero_si128();
+    __m128i a1 = _mm_setzero_si128();
+    for(unsigned j=0; j<np; j++) {
+      __m128i wj = _mm_set1_epi32(w[j]);
+      a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(p+2*j  )), wj));
+      a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(p+2*j+4)), wj));
+    }
+    _mm_storeu_si128((__m128i*)(out+i  ), a0);
+    _mm_storeu_si128((__m128i*)(out+i+4), a1);
+  }
+  return i;
+}
+
+static fir_fixed_fn _select_fir_fixed()
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return _fir_fixed_avx2;
+  if (__builtin_cpu_supports("sse2")) return _fir_fixed_sse;
+  return _fir_fixed_scalar;
+}
+
+#else
+
+static fir_fixed_fn _select_fir_fixed() { return _fir_fixed_scalar; }
+
+#endif
+
+static const fir_fixed_fn _fir_fixed = _select_fir_fixed();
+
+static int32_t _pair(int32_t lo, int32_t hi)
+{
+  return int32_t((uint32_t(hi)<<16) | (uint32_t(lo)&0xffff));
+}
+
+//  Round to nearest, half away from zero
+static int32_t _quantize(double v)
+{
+  return int32_t(v < 0 ? v-0.5 : v+0.5);
+}
+
+static int32_t _pair_lo(int32_t p) { return int16_t(p&0xffff); }
+static int32_t _pair_hi(int32_t p) { return int16_t(uint32_t(p)>>16); }
+
+Filter::Filter() : _method(Direct), _precision(Double), _nfft(0),
+                   _qscale(0), _qmax(0)
+{
+}
+
+Filter::~Filter()
+{
+}
+
+void Filter::configure(const double* weights,
+                       unsigned      nweights,
+                       unsigned      nsignal,
+                       Method        method,
+                       Precision     precision)
+{
+  _weights.assign(weights, weights+nweights);
+  _nfft = 0;
+  _spectrum.clear();
+  _block   .clear();
+
+  _precision = precision;
+  if (_precision==Single)
+    _fweights.assign(weights, weights+nweights);
+  else
+    _fweights.clear();
+
+  //
+  //  Quantize the weights so that the largest is near 2^15/sqrt(r),
+  //  where r is the sum of their magnitudes relative to the largest.
+  //  The samples are then quantized per event to the largest magnitude
+  //  for which no partial sum can exceed 31 bits.
+  //
+  _qweights.clear();
+  _qsignal .clear();
+  _qout    .clear();
+  if (_precision==Fixed) {
+    double wmax = 0, wsum = 0;
+    for(unsigned i=0; i<nweights; i++) {
+      wsum += fabs(weights[i]);
+      if (fabs(weights[i]) > wmax) wmax = fabs(weights[i]);
+    }
+    double qw = wmax > 0 ? floor(sqrt(2147483647./(wsum/wmax))) : 0;
+    if (qw > 32767) qw = 32767;
+    _qscale = wmax > 0 ? qw/wmax : 0;
+
+    std::vector<int32_t> q(nweights+1,0);
+    int64_t qsum = 0;
+    for(unsigned i=0; i<nweights; i++) {
+      q[i] = int32_t(lrint(weights[i]*_qscale));
+      qsum += q[i] < 0 ? -q[i] : q[i];
+    }
+    _qmax = qsum ? int32_t(2147483647/qsum) : 0;
+    if (_qmax > 32767) _qmax = 32767;
+
+    for(unsigned i=0; i<nweights; i+=2)
+      _qweights.push_back(_pair(q[i],q[i+1]));
+    _qsignal.resize(nsignal);
+    _qout   .resize(nsignal);
+  }
+
+  if (nweights==0 || nweights > nsignal) {
+    _method = Direct;
+    return;
+  }
+
+  //
+  //  Choose the FFT block size with the lowest cost per output sample;
+  //  each block yields n-nweights+1 outputs
+  //
+  unsigned nout = nsignal-nweights+1;
+  double   best = 0;
+  unsigned n    = 2;
+  while(n < 2*nweights) n <<= 1;
+  for(; n < 4*(nsignal+nweights); n <<= 1) {
+    unsigned step = n-nweights+1;
+    double cost = double((nout+step-1)/step)*_fft_cost(n);
+    if (_nfft==0 || cost < best) {
+      best  = cost;
+      _nfft = n;
+    }
+  }
+
+  //
+  //  The single precision direct kernels handle eight samples per
+  //  vector operation and the fixed point kernels sixteen
+  //
+  double direct = double(nout)*double(nweights);
+  if (precision==Single)
+    direct /= 8;
+  else if (precision==Fixed)
+    direct /= 16;
+
+  if (method==Auto)
+    method = best < direct ? FFT : Direct;
+  _method = method;
+
+  if (_method==Direct) {
+    _nfft = 0;
+    return;
+  }
+
+  //
+  //  Spectrum of the time-reversed weights, so the convolution yields
+  //  the correlation computed by the direct method
+  //
+  _spectrum.assign(_nfft, 0.);
+  for(unsigned i=0; i<nweights; i++)
+    _spectrum[i] = weights[nweights-1-i];
+  gsl_fft_real_radix2_transform(&_spectrum[0], 1, _nfft);
+
+  _block.resize(_nfft);
+}
+
+unsigned Filter::apply(const double* signal,
+                       unsigned      nsignal,
+                       double*       out,
+                       unsigned&     imax)
+{
+  if (_method==FFT && _weights.size() <= nsignal)
+    return _fft(signal, nsignal, out, imax);
+  if (_precision==Fixed && _weights.size() <= nsignal) {
+    //
+    //  Quantize the samples to the common scale of their largest
+    //  magnitude.  A signal that is not finite is filtered in double
+    //  precision.
+    //
+    double smax = 0;
+    for(unsigned i=0; i<nsignal; i++) {
+      double a = fabs(signal[i]);
+      if (a > smax)
+        smax = a;
+      else if (!(a <= smax)) {
+        smax = a;
+        break;
+      }
+    }
+    if (smax <= DBL_MAX && _qmax > 0) {
+      if (_qsignal.size() < nsignal) {
+        _qsignal.resize(nsignal);
+        _qout   .resize(nsignal);
+      }
+      double sscale = smax > 0 ? double(_qmax)/smax : 0;
+      int32_t q = _quantize(signal[0]*sscale);
+      for(unsigned i=1; i<nsignal; i++) {
+        int32_t qn = _quantize(signal[i]*sscale);
+        _qsignal[i-1] = _pair(q,qn);
+        q = qn;
+      }
+      _qsignal[nsignal-1] = _pair(q,0);
+
+      unsigned n = fir(&_qweights[0], _weights.size(),
+                       &_qsignal[0], nsignal, &_qout[0], imax);
+      double scale = sscale > 0 ? 1./(sscale*_qscale) : 0;
+      for(unsigned i=0; i<n; i++)
+        out[i] = double(_qout[i])*scale;
+      return n;
+    }
+  }
+  return fir(_weights.size() ? &_weights[0] : 0, _weights.size(),
+             signal, nsignal, out, imax);
+}
+
+unsigned Filter::apply(const float* signal,
+                       unsigned     nsignal,
+                       float*       out,
+                       unsigned&    imax)
+{
+  return fir(_fweights.size() ? &_fweights[0] : 0, _fweights.size(),
+             signal, nsignal, out, imax);
+}
+
+unsigned Filter::_fft(const double* s,
+                      unsigned      ns,
+                      double*       out,
+                      unsigned&     imax)
+{
+  const unsigned n    = _nfft;
+  const unsigned nw   = _weights.size();
+  const unsigned nout = ns-nw+1;
+  const unsigned step = n-nw+1;
+  const double*  h    = &_spectrum[0];
+  double*        b    = &_block[0];
+  double         amax = 0;
+  imax = 0;
+
+  //
+  //  Overlap-save: each block of n input samples is transformed,
+  //  multiplied by the weight spectrum and transformed back; the last
+  //  step samples of each circular result are valid outputs
+  //
+  for(unsigned i=0; i<nout; i+=step) {
+    unsigned nin = ns-i < n ? ns-i : n;
+    memcpy(b, s+i, nin*sizeof(double));
+    memset(b+nin, 0, (n-nin)*sizeof(double));
+
+    gsl_fft_real_radix2_transform(b, 1, n);
+
+    b[0]   *= h[0];
+    b[n/2] *= h[n/2];
+    for(unsigned k=1; k<n/2; k++) {
+      double re = b[k], im = b[n-k];
+      b[k]   = re*h[k]   - im*h[n-k];
+      b[n-k] = re*h[n-k] + im*h[k];
+    }
+
+    gsl_fft_halfcomplex_radix2_inverse(b, 1, n);
+
+    unsigned nv = nout-i < step ? nout-i : step;
+    const double* r = b+nw-1;
+    for(unsigned j=0; j<nv; j++) {
+      out[i+j] = r[j];
+      if ((i|j)==0 || r[j] > amax) {
+        amax = r[j];
+        imax = i+j;
+      }
+    }
+  }
+  return nout;
+}
+
+//
+//  The four group means of lroe: left/right half, even/odd element
+//
+static void _lroe(const int*    e,
+                  const double* b,
+                  unsigned      n,
+                  double*       s)
+{
+  const unsigned h = n/2;
+  unsigned c[4] = {0,0,0,0};
+  s[0] = s[1] = s[2] = s[3] = 0;
+
+  for(unsigned i=0; i<n; i++) {
+    unsigned g = (i<h ? 0:2) + (i&1);
+    s[g] += double(e[i])-b[i];
+    c[g]++;
+  }
+
+  for(unsigned g=0; g<4; g++)
+    if (c[g]) s[g] /= double(c[g]);
+}
+
+static void _expand(const double* s,
+                    unsigned      n,
+                    double*       out)
+{
+  const unsigned h = n/2;
+  for(unsigned i=0; i<n; i++)
+    out[i] = s[(i<h ? 0:2) + (i&1)];
+}
+
+void Filter::lroe(const int*    e,
+                  const double* b,
+                  unsigned      n,
+                  double*       out)
+{
+  double s[4];
+  _lroe(e, b, n, s);
+  _expand(s, n, out);
+}
+
+void Filter::lroe(const int*    e,
+                  const double* b,
+                  unsigned      rows,
+                  unsigned      cols,
+                  double*       out)
+{
+  for(unsigned i=0; i<rows; i++, e+=cols, b+=cols, out+=cols)
+    lroe(e, b, cols, out);
+}
+
+void Filter::lroe_means(const int*    e,
+                        const double* b,
+                        unsigned      rows,
+                        unsigned      cols,
+                        double*       out)
+{
+  for(unsigned i=0; i<rows; i++, e+=cols, b+=cols, out+=4)
+    _lroe(e, b, cols, out);
+}
+
+void Filter::lroe_expand(const double* means,
+                         unsigned      rows,
+                         unsigned      cols,
+                         double*       out)
+{
+  for(unsigned i=0; i<rows; i++, means+=4, out+=cols)
+    _expand(means, cols, out);
+}
+
+//
+//  Rolling average update of b over [lo,hi) with the sums of e-b over
+//  the even and odd elements.  Each sum accumulates in index order as in
+//  lroe, with the pairs unrolled so that the loop vectorizes.
+//
+static void _rolling_sums(const int* e,
+                          double*    b,
+                          double     f,
+                          unsigned   lo,
+                          unsigned   hi,
+                          double*    s)
+{
+  const double g = 1-f;
+  double se = 0, so = 0;
+  unsigned i = lo;
+  if ((i&1) && i<hi) {
+    b[i] = g*b[i] + f*double(e[i]);
+    so  += double(e[i])-b[i];
+    i++;
+  }
+  for(; i+1<hi; i+=2) {
+    b[i  ] = g*b[i  ] + f*double(e[i  ]);
+    b[i+1] = g*b[i+1] + f*double(e[i+1]);
+    se += double(e[i  ])-b[i  ];
+    so += double(e[i+1])-b[i+1];
+  }
+  if (i<hi) {
+    b[i] = g*b[i] + f*double(e[i]);
+    se  += double(e[i])-b[i];
+  }
+  s[0] = se;
+  s[1] = so;
+}
+
+static void _rolling_lroe(const int* e,
+                          double*    b,
+                          double     f,
+                          unsigned   n,
+                          double*    s)
+{
+  const unsigned h = n/2;
+  _rolling_sums(e, b, f, 0, h, &s[0]);
+  _rolling_sums(e, b, f, h, n, &s[2]);
+
+  //  number of even and odd elements in each half
+  unsigned c[4] = { (h+1)/2, h/2, (n+1)/2-(h+1)/2, n/2-h/2 };
+  for(unsigned g=0; g<4; g++)
+    if (c[g]) s[g] /= double(c[g]);
+}
+
+void Filter::rolling_lroe(const int* e,
+                          double*    b,
+                          double     f,
+                          unsigned   n,
+                          double*    out)
+{
+  double s[4];
+  _rolling_lroe(e, b, f, n, s);
+  _expand(s, n, out);
+}
+
+void Filter::rolling_lroe(const int* e,
+                          double*    b,
+                          double     f,
+                          unsigned   rows,
+                          unsigned   cols,
+                          double*    out)
+{
+  for(unsigned i=0; i<rows; i++, e+=cols, b+=cols, out+=cols)
+    rolling_lroe(e, b, f, cols, out);
+}
+
+void Filter::rolling_lroe_means(const int* e,
+                                double*    b,
+                                double     f,
+                                unsigned   rows,
+                                unsigned   cols,
+                                double*    out)
+{
+  for(unsigned i=0; i<rows; i++, e+=cols, b+=cols, out+=4)
+    _rolling_lroe(e, b, f, cols, out);
+}
+
+template<class T>
+static unsigned _decimate(const T*  in,
+                          unsigned  n,
+                          unsigned  factor,
+                          double*   out)
+{
+  const unsigned m = n/factor;
+  for(unsigned i=0; i<m; i++, in+=factor) {
+    double v = 0;
+    for(unsigned j=0; j<factor; j++)
+      v += in[j];
+    out[i] = v;
+  }
+  return m;
+}
+
+unsigned Filter::decimate(const double* in,
+                          unsigned      n,
+                          unsigned      factor,
+                          double*       out)
+{
+  return _decimate(in, n, factor, out);
+}
+
+unsigned Filter::decimate(const float*  in,
+                          unsigned      n,
+                          unsigned      factor,
+                          double*       out)
+{
+  return _decimate(in, n, factor, out);
+}
+
+unsigned Filter::fir(const double* w,
+                     unsigned      nw,
+                     const double* s,
+                     unsigned      ns,
+                     double*       out,
+                     unsigned&     imax)
+{
+  imax = 0;
+  if (nw > ns) return 0;
+
+  const unsigned n = ns-nw+1;
+  double amax = 0;
+  for(unsigned i=0; i<n; i++) {
+    const double* p = s+i;
+    double v = 0;
+    for(unsigned j=0; j<nw; j++)
+      v += p[j]*w[j];
+    out[i] = v;
+    if (i==0 || v > amax) {
+      amax = v;
+      imax = i;
+    }
+  }
+  return n;
+}
+
+unsigned Filter::fir(const float* w,
+                     unsigned     nw,
+                     const float* s,
+                     unsigned     ns,
+                     float*       out,
+                     unsigned&    imax)
+{
+  imax = 0;
+  if (nw > ns) return 0;
+
+  const unsigned n = ns-nw+1;
+  for(unsigned i=_fir_float(w, nw, s, n, out); i<n; i++) {
+    const float* p = s+i;
+    float v = 0;
+    for(unsigned j=0; j<nw; j++)
+      v += p[j]*w[j];
+    out[i] = v;
+  }
+
+  float amax = out[0];
+  for(unsigned i=1; i<n; i++)
+    if (out[i] > amax) {
+      amax = out[i];
+      imax = i;
+    }
+  return n;
+}
+
+unsigned Filter::fir(const int32_t* w,
+                     unsigned       nw,
+                     const int32_t* s,
+                     unsigned       ns,
+                     int32_t*       out,
+                     unsigned&      imax)
+{
+  imax = 0;
+  if (nw==0 || nw > ns) return 0;
+
+  const unsigned n  = ns-nw+1;
+  const unsigned np = (nw+1)/2;
+  for(unsigned i=_fir_fixed(w, np, s, n, out); i<n; i++) {
+    const int32_t* p = s+i;
+    int32_t v = 0;
+    for(unsigned j=0; j<np; j++)
+      v += _pair_lo(p[2*j])*_pair_lo(w[j]) + _pair_hi(p[2*j])*_pair_hi(w[j]);
+    out[i] = v;
+  }
+
+  int32_t amax = out[0];
+  for(unsigned i=1; i<n; i++)
+    if (out[i] > amax) {
+      amax = out[i];
+      imax = i;
+    }
+  return n;
+}
+
+template<class T>
+static unsigned _peaks(const T*  q,
+                       unsigned  n,
+                       unsigned  imax,
+                       double    afrac,
+                       unsigned* pk)
+{
+  if (n==0) return 0;
+
+  const double thr = afrac*q[imax];
+  if (!(q[imax] > thr)) return 0;
+
+  pk[0] = imax;
+
+  //
+  //  The region of the highest peak is the run above threshold around
+  //  it.  The next peak is the highest sample above threshold outside
+  //  that run, which is the maximum of its own region.
+  //
+  unsigned lo = imax, hi = imax;
+  while(lo>0 && q[lo-1] > thr) lo--;
+  while(hi+1<n && q[hi+1] > thr) hi++;
+
+  unsigned inxt = n;
+  for(unsigned i=0; i<lo; i++)
+    if (q[i] > thr && (inxt==n || q[i] > q[inxt]))
+      inxt = i;
+  for(unsigned i=hi+1; i<n; i++)
+    if (q[i] > thr && (inxt==n || q[i] > q[inxt]))
+      inxt = i;
+
+  if (inxt==n) return 1;
+  pk[1] = inxt;
+  return 2;
+}
+
+unsigned Filter::peaks(const double* q,
+                       unsigned      n,
+                       unsigned      imax,
+                       double        afrac,
+                       unsigned*     pk)
+{
+  return _peaks(q, n, imax, afrac, pk);
+}
+
+unsigned Filter::peaks(const float*  q,
+                       unsigned      n,
+                       unsigned      imax,
+                       double        afrac,
+                       unsigned*     pk)
+{
+  return _peaks(q, n, imax, afrac, pk);
+}
+
+//
+//  Heap of peak indices ordered by the value of q, lowest at the root;
+//  of equal values the later peak ranks lower
+//
+template<class T>
+static inline bool _below(const T* q, unsigned a, unsigned b)
+{
+  return q[a] < q[b] || (q[a] == q[b] && a > b);
+}
+
+template<class T>
+static void _sift_down(const T* q, unsigned* h, unsigned n, unsigned i)
+{
+  while(true) {
+    unsigned m = i, l = 2*i+1, r = l+1;
+    if (l<n && _below(q, h[l], h[m])) m = l;
+    if (r<n && _below(q, h[r], h[m])) m = r;
+    if (m==i) return;
+    unsigned t = h[i]; h[i] = h[m]; h[m] = t;
+    i = m;
+  }
+}
+
+template<class T>
+static void _offer(const T* q, unsigned* h, unsigned& nh, unsigned k, unsigned c)
+{
+  if (nh < k) {
+    unsigned i = nh++;
+    h[i] = c;
+    while(i>0 && _below(q, h[i], h[(i-1)/2])) {
+      unsigned p = (i-1)/2;
+      unsigned t = h[i]; h[i] = h[p]; h[p] = t;
+      i = p;
+    }
+  }
+  else if (_below(q, h[0], c)) {
+    h[0] = c;
+    _sift_down(q, h, nh, 0);
+  }
+}
+
+template<class T>
+static unsigned _peaks(const T*  q,
+                       unsigned  n,
+                       unsigned  imax,
+                       double    afrac,
+                       unsigned  k,
+                       unsigned  minsep,
+                       unsigned* pk)
+{
+  if (n==0 || k==0) return 0;
+
+  const double thr = afrac*q[imax];
+  if (!(q[imax] > thr)) return 0;
+
+  //
+  //  The maximum of each run above threshold is a candidate; a candidate
+  //  within minsep of the previous one replaces it if higher, and is
+  //  dropped otherwise.  The previous candidate is offered to the heap
+  //  once no later candidate can replace it.
+  //
+  unsigned nh = 0;
+  unsigned p  = n;
+  for(unsigned i=0; i<n; ) {
+    if (!(q[i] > thr)) {
+      i++;
+      continue;
+    }
+    unsigned m = i;
+    for(; i<n && q[i] > thr; i++)
+      if (q[i] > q[m])
+        m = i;
+    if (p<n && m-p < minsep) {
+      if (_below(q, p, m))
+        p = m;
+    }
+    else {
+      if (p<n)
+        _offer(q, pk, nh, k, p);
+      p = m;
+    }
+  }
+  if (p<n)
+    _offer(q, pk, nh, k, p);
+
+  //
+  //  Heap sort into descending order
+  //
+  for(unsigned j=nh; j>1; j--) {
+    unsigned t = pk[0]; pk[0] = pk[j-1]; pk[j-1] = t;
+    _sift_down(q, pk, j-1, 0);
+  }
+  return nh;
+}
+
+unsigned Filter::peaks(const double* q,
+                       unsigned      n,
+                       unsigned      imax,
+                       double        afrac,
+                       unsigned      k,
+                       unsigned      minsep,
+                       unsigned*     pk)
+{
+  return _peaks(q, n, imax, afrac, k, minsep, pk);
+}
+
+unsigned Filter::peaks(const float*  q,
+                       unsigned      n,
+                       unsigned      imax,
+                       double        afrac,
+                       unsigned      k,
+                       unsigned      minsep,
+                       unsigned*     pk)
+{
+  return _peaks(q, n, imax, afrac, k, minsep, pk);
+}
+
+template<class T>
+static void _parab_fit(const T*  y,
+                       unsigned  n,
+                       unsigned  ix,
+                       double    afrac,
+                       double*   r)
+{
+  r[0] = r[1] = r[2] = 0;
+
+  const double thr = afrac*y[ix];
+  unsigned lo = ix, hi = ix;
+  while(lo>0 && y[lo-1] >= thr) lo--;
+  while(hi+1<n && y[hi+1] >= thr) hi++;
+  if (hi-lo < 2) return;
+
+  //
+  //  Least squares quadratic y = c0 + c1*x + c2*x^2 with x relative to ix
+  //
+  double s[5] = {0,0,0,0,0};
+  double t[3] = {0,0,0};
+  for(unsigned i=lo; i<=hi; i++) {
+    double x  = double(i)-double(ix);
+    double xx = 1;
+    for(unsigned k=0; k<5; k++) {
+      s[k] += xx;
+      if (k<3) t[k] += xx*y[i];
+      xx *= x;
+    }
+  }
+
+  double d = s[0]*(s[2]*s[4]-s[3]*s[3]) - s[1]*(s[1]*s[4]-s[3]*s[2]) + s[2]*(s[1]*s[3]-s[2]*s[2]);
+  if (d==0) return;
+
+  double c0 = (t[0]*(s[2]*s[4]-s[3]*s[3]) - s[1]*(t[1]*s[4]-s[3]*t[2]) + s[2]*(t[1]*s[3]-s[2]*t[2]))/d;
+  double c1 = (s[0]*(t[1]*s[4]-s[3]*t[2]) - t[0]*(s[1]*s[4]-s[3]*s[2]) + s[2]*(s[1]*t[2]-t[1]*s[2]))/d;
+  double c2 = (s[0]*(s[2]*t[2]-t[1]*s[3]) - s[1]*(s[1]*t[2]-t[1]*s[2]) + t[0]*(s[1]*s[3]-s[2]*s[2]))/d;
+  if (c2 >= 0) return;
+
+  double x0 = -c1/(2*c2);
+  double a  = c0-c1*c1/(4*c2);
+  if (a <= 0) return;
+
+  r[0] = a;
+  r[1] = double(ix)+x0;
+  r[2] = sqrt(-2*a/c2);
+}
+
+void Filter::parab_fit(const double* y,
+                       unsigned      n,
+                       unsigned      ix,
+                       double        afrac,
+                       double*       r)
+{
+  _parab_fit(y, n, ix, afrac, r);
+}
+
+void Filter::parab_fit(const float*  y,
+                       unsigned      n,
+                       unsigned      ix,
+                       double        afrac,
+                       double*       r)
+{
+  _parab_fit(y, n, ix, afrac, r);
+}
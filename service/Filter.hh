@@ -0,0 +1,208 @@
+#ifndef TimeTool_Filter_hh
+#define TimeTool_Filter_hh
+
+#include <vector>
+
+#include <stdint.h>
+
+namespace TimeTool {
+
+  //
+  //  Sideband common mode and digital filter stages.  Results are
+  //  written into caller supplied buffers so that no memory is
+  //  allocated per event.
+  //
+  //  The digital filter is applied either directly or by overlap-save
+  //  FFT convolution.  The method, FFT block size and filter spectrum
+  //  are chosen when the filter is configured from the number of
+  //  weights and the expected signal length.
+  //
+  //  The direct method may run in single precision: the camera data has
+  //  far fewer significant bits than a float, and the float kernel
+  //  processes twice as many samples per vector with half the memory
+  //  traffic.  A single precision filter takes and returns float
+  //  samples, so that the projection stays in float from the
+  //  normalization to the edge fit.  It may also run in fixed point:
+  //  the weights are quantized to 16 bits when the filter is configured
+  //  and the signal to 16 bits per event with a common scale (block
+  //  floating point).  Products accumulate exactly in 32 bits, with the
+  //  scales chosen so that no sum can overflow, and the 16-bit kernels
+  //  handle sixteen samples per vector.  A double precision signal is
+  //  always filtered to a double precision result.
+  //
+  class Filter {
+  public:
+    enum Method    { Auto, Direct, FFT };
+    enum Precision { Double, Single, Fixed };
+  public:
+    Filter();
+    ~Filter();
+  public:
+    void     configure(const double* weights,
+                       unsigned      nweights,
+                       unsigned      nsignal,
+                       Method        method=Auto,
+                       Precision     precision=Double);
+    //  Correlate the signal with the configured weights over the region
+    //  of full overlap; returns the number of output samples.  The index
+    //  of the (first) maximum output sample is tracked as the output is
+    //  produced.
+    unsigned apply    (const double* signal,
+                       unsigned      nsignal,
+                       double*       out,
+                       unsigned&     imax);
+    //  Single precision direct correlation (Single precision and Direct
+    //  method only)
+    unsigned apply    (const float*  signal,
+                       unsigned      nsignal,
+                       float*        out,
+                       unsigned&     imax);
+    Method    method   () const { return _method; }
+    Precision precision() const { return _precision; }
+    unsigned  block    () const { return _nfft; }
+  public:
+    //  Left/right half, odd/even element common mode of e-baseline;
+    //  each output element is the mean of its group
+    static void     lroe(const int*    e,
+                         const double* baseline,
+                         unsigned      n,
+                         double*       out);
+    //  Row by row common mode of a rows x cols region
+    static void     lroe(const int*    e,
+                         const double* baseline,
+                         unsigned      rows,
+                         unsigned      cols,
+                         double*       out);
+    //  lroe fused with the rolling average update of the baseline,
+    //  baseline = (1-fraction)*baseline + fraction*e, in the same pass.
+    //  The common mode is taken against the updated baseline.
+    static void     rolling_lroe(const int* e,
+                                 double*    baseline,
+                                 double     fraction,
+                                 unsigned   n,
+                                 double*    out);
+    static void     rolling_lroe(const int* e,
+                                 double*    baseline,
+                                 double     fraction,
+                                 unsigned   rows,
+                                 unsigned   cols,
+                                 double*    out);
+    //  Row by row common mode as the four group means of each row
+    //  (rows x 4: left even, left odd, right even, right odd), and the
+    //  expansion of the means to the rows x cols correction
+    static void     lroe_means(const int*    e,
+                               const double* baseline,
+                               unsigned      rows,
+                               unsigned      cols,
+                               double*       out);
+    static void     rolling_lroe_means(const int* e,
+                                       double*    baseline,
+                                       double     fraction,
+                                       unsigned   rows,
+                                       unsigned   cols,
+                                       double*    out);
+    static void     lroe_expand(const double* means,
+                                unsigned      rows,
+                                unsigned      cols,
+                                double*       out);
+    //  Sums of consecutive groups of factor samples (a trailing partial
+    //  group is dropped); returns the number of output samples
+    static unsigned decimate(const double* in,
+                             unsigned      n,
+                             unsigned      factor,
+                             double*       out);
+    static unsigned decimate(const float*  in,
+                             unsigned      n,
+                             unsigned      factor,
+                             double*       out);
+    //  Direct correlation of the signal with the weights over the
+    //  region of full overlap; returns the number of output samples
+    //  (0 if there are more weights than samples)
+    static unsigned fir (const double* weights,
+                         unsigned      nweights,
+                         const double* signal,
+                         unsigned      nsignal,
+                         double*       out,
+                         unsigned&     imax);
+    static unsigned fir (const float*  weights,
+                         unsigned      nweights,
+                         const float*  signal,
+                         unsigned      nsignal,
+                         float*        out,
+                         unsigned&     imax);
+    //  Fixed point correlation of the sample pairs (signal[k],signal[k+1])
+    //  with the weight pairs (weights[2j],weights[2j+1]), each pair packed
+    //  low element first into 32 bits; returns the number of outputs
+    static unsigned fir (const int32_t* weight_pairs,
+                         unsigned       nweights,
+                         const int32_t* signal_pairs,
+                         unsigned       nsignal,
+                         int32_t*       out,
+                         unsigned&      imax);
+    //  Find the two highest well-separated peaks of q given the index of
+    //  its maximum.  Peaks are the maxima of the regions above afrac of
+    //  the maximum value.  Returns the number of peaks (0-2) in peaks.
+    static unsigned peaks(const double* q,
+                          unsigned      n,
+                          unsigned      imax,
+                          double        afrac,
+                          unsigned*     peaks);
+    static unsigned peaks(const float*  q,
+                          unsigned      n,
+                          unsigned      imax,
+                          double        afrac,
+                          unsigned*     peaks);
+    //  The k highest peaks of q in descending order.  Each region above
+    //  afrac of the maximum value contributes its maximum, and of two
+    //  such peaks closer than minsep samples only the higher is kept.
+    //  The peaks are selected with a heap of k elements held in peaks
+    //  (O(n log k), no allocation).  Returns the number of peaks.
+    static unsigned peaks(const double* q,
+                          unsigned      n,
+                          unsigned      imax,
+                          double        afrac,
+                          unsigned      k,
+                          unsigned      minsep,
+                          unsigned*     peaks);
+    static unsigned peaks(const float*  q,
+                          unsigned      n,
+                          unsigned      imax,
+                          double        afrac,
+                          unsigned      k,
+                          unsigned      minsep,
+                          unsigned*     peaks);
+    //  Parabolic fit to the samples of y around ix that are at least
+    //  afrac of y[ix]; result is amplitude, position and width (all zero
+    //  if the fit fails)
+    static void parab_fit(const double* y,
+                          unsigned      n,
+                          unsigned      ix,
+                          double        afrac,
+                          double*       result);
+    static void parab_fit(const float*  y,
+                          unsigned      n,
+                          unsigned      ix,
+                          double        afrac,
+                          double*       result);
+  private:
+    unsigned _fft(const double* signal,
+                  unsigned      nsignal,
+                  double*       out,
+                  unsigned&     imax);
+  private:
+    Method              _method;
+    Precision           _precision;
+    std::vector<double> _weights;
+    unsigned            _nfft;      // FFT block size
+    std::vector<double> _spectrum;  // halfcomplex spectrum of the weights
+    std::vector<double> _block;     // FFT work block
+    std::vector<float>  _fweights;  // single precision weights
+    std::vector<int32_t> _qweights; // fixed point weight pairs
+    std::vector<int32_t> _qsignal;  // fixed point sample pairs
+    std::vector<int32_t> _qout;     // fixed point result
+    double              _qscale;    // weight quantization scale
+    int32_t             _qmax;      // largest quantized sample magnitude
+  };
+};
+
+#endif
@@ -83,6 +83,9 @@ void Fitter::configure(size_t npoints,
   _fit_params = make_ndarray<double>(fit_params.size());
   std::copy(fit_params.begin(), fit_params.end(), _fit_params.begin());
 
+  /* allocate the fit weights once per configuration */
+  _weights = make_ndarray<double>(npoints);
+
   /* initialize the x values */
   _times = new double[npoints];
   for (unsigned i=0; i<npoints; i++)
@@ -140,12 +143,11 @@ bool Fitter::fit(const ndarray<const double,1>& input,
   /* if the weights scale factor is > 0.0 then create weights to use */
   if (_scale > 0.0) {
     /* create weights */
-    ndarray<double,1> weights = make_ndarray<double>(input.size());
-    for (unsigned i=0; i<weights.size(); i++)
-      weights[i] = _scale * input[i];
+    for (unsigned i=0; i<_weights.size(); i++)
+      _weights[i] = _scale * input[i];
 
     /* create gsl vector view for weights */
-    gsl_vector_view wts = gsl_vector_view_array(weights.data(), _fdf.n);
+    gsl_vector_view wts = gsl_vector_view_array(_weights.data(), _fdf.n);
 
     /* initialize solver with starting values and weights */
     gsl_multifit_nlinear_winit (&x.vector, &wts.vector, &_fdf, _w);
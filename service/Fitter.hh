@@ -37,6 +37,7 @@ namespace TimeTool {
     double*                          _times;
     const double*                    _values;
     ndarray<double,1>                _fit_params;
+    ndarray<double,1>                _weights;
     const gsl_multifit_nlinear_type* _T;
     gsl_multifit_nlinear_workspace*  _w;
     gsl_multifit_nlinear_fdf         _fdf;
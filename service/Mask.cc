@@ -0,0 +1,99 @@
+#include "Mask.hh"
+
+#include <math.h>
+
+using namespace TimeTool;
+
+Mask::Mask() : _nmasked(0)
+{
+}
+
+Mask::~Mask()
+{
+}
+
+static bool _masked(const std::string* line, unsigned j)
+{
+  return line && j < line->size() && (*line)[j]=='1';
+}
+
+void Mask::compile(const std::vector<std::string>& bitmap,
+                   const unsigned* lo,
+                   const unsigned* hi,
+                   unsigned        pdim)
+{
+  const unsigned rows  = hi[0]-lo[0]+1;
+  const unsigned cols  = hi[1]-lo[1]+1;
+  const unsigned nbins = pdim==1 ? cols : rows;
+
+  _runs .clear();
+  _scale.clear();
+  _fill .clear();
+  _nmasked = 0;
+
+  std::vector<unsigned> ngood(nbins,0);
+
+  for(unsigned r=0; r<rows; r++) {
+    const std::string* line = lo[0]+r < bitmap.size() ? &bitmap[lo[0]+r] : 0;
+    unsigned c=0;
+    while(c<cols) {
+      while(c<cols && _masked(line, lo[1]+c)) {
+        _nmasked++;
+        c++;
+      }
+      Run run;
+      run.row = r;
+      run.col = c;
+      while(c<cols && !_masked(line, lo[1]+c))
+        c++;
+      run.n = c-run.col;
+      if (run.n) {
+        _runs.push_back(run);
+        if (pdim==1)
+          for(unsigned j=run.col; j<c; j++)
+            ngood[j]++;
+        else
+          ngood[r] += run.n;
+      }
+    }
+  }
+
+  const unsigned ntotal = pdim==1 ? rows : cols;
+  for(unsigned k=0; k<nbins; k++) {
+    if (ngood[k]==ntotal)
+      continue;
+    if (ngood[k]) {
+      Scale s = { k, ngood[k], ntotal };
+      _scale.push_back(s);
+    }
+    else {
+      Fill f = { k, -1, -1 };
+      for(int j=int(k)-1; j>=0; j--)
+        if (ngood[j]) { f.left = j; break; }
+      for(unsigned j=k+1; j<nbins; j++)
+        if (ngood[j]) { f.right = j; break; }
+      _fill.push_back(f);
+    }
+  }
+}
+
+void Mask::fill(int* proj) const
+{
+  for(unsigned i=0; i<_scale.size(); i++) {
+    const Scale& s = _scale[i];
+    proj[s.bin] = int(lrint(double(proj[s.bin])*double(s.ntotal)/double(s.ngood)));
+  }
+  for(unsigned i=0; i<_fill.size(); i++) {
+    const Fill& f = _fill[i];
+    if (f.left<0 && f.right<0)
+      proj[f.bin] = 0;
+    else if (f.left<0)
+      proj[f.bin] = proj[f.right];
+    else if (f.right<0)
+      proj[f.bin] = proj[f.left];
+    else
+      proj[f.bin] = proj[f.left] +
+        int(lrint(double(proj[f.right]-proj[f.left])*
+                  double(int(f.bin)-f.left)/double(f.right-f.left)));
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef TimeTool_Mask_hh
+#define TimeTool_Mask_hh
+
+#include <string>
+#include <vector>
+
+namespace TimeTool {
+
+  //
+  //  Bad pixel mask of one ROI compiled into a run-length skip list.
+  //  The frame bitmap has one line per frame row with '1' marking a
+  //  masked pixel; rows and columns beyond the bitmap are unmasked.
+  //
+  //  The projection kernels only visit the runs of unmasked pixels, so
+  //  no pixel is tested while the frame is read.  Projection elements
+  //  that lost some pixels are scaled up to the full ROI extent, and
+  //  elements that lost all of them are interpolated from their nearest
+  //  unmasked neighbours.
+  //
+  class Mask {
+  public:
+    struct Run { unsigned row, col, n; };  // relative to the ROI
+  public:
+    Mask();
+    ~Mask();
+  public:
+    void compile(const std::vector<std::string>& bitmap,
+                 const unsigned* lo,
+                 const unsigned* hi,
+                 unsigned        pdim);
+    //  No pixel of the ROI is masked
+    bool empty() const { return _nmasked==0; }
+    const std::vector<Run>& runs() const { return _runs; }
+    //  Complete a projection accumulated over the runs
+    void fill (int* proj) const;
+  private:
+    struct Scale { unsigned bin, ngood, ntotal; };
+    struct Fill  { unsigned bin; int left, right; };
+    std::vector<Run>   _runs;
+    std::vector<Scale> _scale;  // partially masked projection elements
+    std::vector<Fill>  _fill;   // fully masked projection elements
+    unsigned           _nmasked;
+  };
+};
+
+#endif
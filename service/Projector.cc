@@ -0,0 +1,1027 @@
+#include "Projector.hh"
+#include "Mask.hh"
+
+#include <float.h>
+#include <limits.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (__GNUC__ >= 5) && (defined(__x86_64__) || defined(__i386__))
+#define TT_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace TimeTool;
+
+//
+//  Integer kernels for the frame pass.  Each widens uint16 pixels to
+//  int32 and subtracts the pedestal; the vector versions produce the
+//  same integer results as the scalar ones.
+//
+//    accumulate : acc[j] += p[j]-ped
+//    rowsum     : returns sum of p[j]
+//    rowsum4    : out[r]  = sum of p[r][j] for a block of four rows
+//    widen      : out[j]  = p[j]-ped
+//    subtract   : out[j]  = p[j]-d[j]   (per-pixel pedestal map)
+//
+//  rowsum4 keeps four independent accumulators in flight so that the
+//  Y projection streams rows at the same rate as the X projection
+//  instead of stalling on each row's horizontal reduction.
+//
+typedef void (*accumulate_fn)(const uint16_t*, unsigned, int, int*);
+typedef int  (*rowsum_fn    )(const uint16_t*, unsigned);
+typedef void (*rowsum4_fn   )(const uint16_t* const*, unsigned, int*);
+typedef void (*widen_fn     )(const uint16_t*, unsigned, int, int*);
+typedef void (*subtract_fn  )(const uint16_t*, unsigned, const int*, int*);
+
+struct Kernels {
+  const char*   name;
+  accumulate_fn accumulate;
+  rowsum_fn     rowsum;
+  rowsum4_fn    rowsum4;
+  widen_fn      widen;
+  subtract_fn   subtract;
+};
+
+static void accumulate_scalar(const uint16_t* p, unsigned n, int ped, int* acc)
+{
+  for(unsigned j=0; j<n; j++)
+    acc[j] += int(p[j])-ped;
+}
+
+static int rowsum_scalar(const uint16_t* p, unsigned n)
+{
+  int v = 0;
+  for(unsigned j=0; j<n; j++)
+    v += p[j];
+  return v;
+}
+
+static void rowsum4_scalar(const uint16_t* const* p, unsigned n, int* out)
+{
+  int v0=0, v1=0, v2=0, v3=0;
+  for(unsigned j=0; j<n; j++) {
+    v0 += p[0][j];
+    v1 += p[1][j];
+    v2 += p[2][j];
+    v3 += p[3][j];
+  }
+  out[0]=v0; out[1]=v1; out[2]=v2; out[3]=v3;
+}
+
+static void widen_scalar(const uint16_t* p, unsigned n, int ped, int* out)
+{
+  for(unsigned j=0; j<n; j++)
+    out[j] = int(p[j])-ped;
+}
+
+static void subtract_scalar(const uint16_t* p, unsigned n, const int* d, int* out)
+{
+  for(unsigned j=0; j<n; j++)
+    out[j] = int(p[j])-d[j];
+}
+
+#ifdef TT_SIMD
+
+__attribute__((target("sse4.1")))
+static void accumulate_sse4(const uint16_t* p, unsigned n, int ped, int* acc)
+{
+  const __m128i vped = _mm_set1_epi32(ped);
+  unsigned j=0;
+  for(; j+8<=n; j+=8) {
+    __m128i v  = _mm_loadu_si128((const __m128i*)(p+j));
+    __m128i lo = _mm_sub_epi32(_mm_cvtepu16_epi32(v), vped);
+    __m128i hi = _mm_sub_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(v,8)), vped);
+    __m128i* a = (__m128i*)(acc+j);
+    _mm_storeu_si128(a  , _mm_add_epi32(_mm_loadu_si128(a  ), lo));
+    _mm_storeu_si128(a+1, _mm_add_epi32(_mm_loadu_si128(a+1), hi));
+  }
+  accumulate_scalar(p+j, n-j, ped, acc+j);
+}
+
+__attribute__((target("sse4.1")))
+static int rowsum_sse4(const uint16_t* p, unsigned n)
+{
+  __m128i s = _mm_setzero_si128();
+  unsigned j=0;
+  for(; j+8<=n; j+=8) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(p+j));
+    s = _mm_add_epi32(s, _mm_cvtepu16_epi32(v));
+    s = _mm_add_epi32(s, _mm_cvtepu16_epi32(_mm_srli_si128(v,8)));
+  }
+  s = _mm_add_epi32(s, _mm_srli_si128(s,8));
+  s = _mm_add_epi32(s, _mm_srli_si128(s,4));
+  return _mm_cvtsi128_si32(s) + rowsum_scalar(p+j, n-j);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i _sum8_sse4(__m128i s, const uint16_t* p)
+{
+  __m128i v = _mm_loadu_si128((const __m128i*)p);
+  s = _mm_add_epi32(s, _mm_cvtepu16_epi32(v));
+  return _mm_add_epi32(s, _mm_cvtepu16_epi32(_mm_srli_si128(v,8)));
+}
+
+__attribute__((target("sse4.1")))
+static inline int _hsum_sse4(__m128i s)
+{
+  s = _mm_add_epi32(s, _mm_srli_si128(s,8));
+  s = _mm_add_epi32(s, _mm_srli_si128(s,4));
+  return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("sse4.1")))
+static void rowsum4_sse4(const uint16_t* const* p, unsigned n, int* out)
+{
+  __m128i s0 = _mm_setzero_si128();
+  __m128i s1 = _mm_setzero_si128();
+  __m128i s2 = _mm_setzero_si128();
+  __m128i s3 = _mm_setzero_si128();
+  unsigned j=0;
+  for(; j+8<=n; j+=8) {
+    s0 = _sum8_sse4(s0, p[0]+j);
+    s1 = _sum8_sse4(s1, p[1]+j);
+    s2 = _sum8_sse4(s2, p[2]+j);
+    s3 = _sum8_sse4(s3, p[3]+j);
+  }
+  out[0] = _hsum_sse4(s0) + rowsum_scalar(p[0]+j, n-j);
+  out[1] = _hsum_sse4(s1) + rowsum_scalar(p[1]+j, n-j);
+  out[2] = _hsum_sse4(s2) + rowsum_scalar(p[2]+j, n-j);
+  out[3] = _hsum_sse4(s3) + rowsum_scalar(p[3]+j, n-j);
+}
+
+__attribute__((target("sse4.1")))
+static void widen_sse4(const uint16_t* p, unsigned n, int ped, int* out)
+{
+  const __m128i vped = _mm_set1_epi32(ped);
+  unsigned j=0;
+  for(; j+8<=n; j+=8) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(p+j));
+    _mm_storeu_si128((__m128i*)(out+j  ), _mm_sub_epi32(_mm_cvtepu16_epi32(v), vped));
+    _mm_storeu_si128((__m128i*)(out+j+4), _mm_sub_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(v,8)), vped));
+  }
+  widen_scalar(p+j, n-j, ped, out+j);
+}
+
+__attribute__((target("sse4.1")))
+static void subtract_sse4(const uint16_t* p, unsigned n, const int* d, int* out)
+{
+  unsigned j=0;
+  for(; j+8<=n; j+=8) {
+    __m128i v  = _mm_loadu_si128((const __m128i*)(p+j));
+    __m128i d0 = _mm_loadu_si128((const __m128i*)(d+j  ));
+    __m128i d1 = _mm_loadu_si128((const __m128i*)(d+j+4));
+    _mm_storeu_si128((__m128i*)(out+j  ), _mm_sub_epi32(_mm_cvtepu16_epi32(v), d0));
+    _mm_storeu_si128((__m128i*)(out+j+4), _mm_sub_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(v,8)), d1));
+  }
+  subtract_scalar(p+j, n-j, d+j, out+j);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(const uint16_t* p, unsigned n, int ped, int* acc)
+{
+  const __m256i vped = _mm256_set1_epi32(ped);
+  unsigned j=0;
+  for(; j+16<=n; j+=16) {
+    __m256i lo = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p+j  )));
+    __m256i hi = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p+j+8)));
+    __m256i* a = (__m256i*)(acc+j);
+    _mm256_storeu_si256(a  , _mm256_add_epi32(_mm256_loadu_si256(a  ), _mm256_sub_epi32(lo, vped)));
+    _mm256_storeu_si256(a+1, _mm256_add_epi32(_mm256_loadu_si256(a+1), _mm256_sub_epi32(hi, vped)));
+  }
+  accumulate_scalar(p+j, n-j, ped, acc+j);
+}
+
+__attribute__((target("avx2")))
+static int rowsum_avx2(const uint16_t* p, unsigned n)
+{
+  __m256i s = _mm256_setzero_si256();
+  unsigned j=0;
+  for(; j+16<=n; j+=16) {
+    s = _mm256_add_epi32(s, _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p+j  ))));
+    s = _mm256_add_epi32(s, _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p+j+8))));
+  }
+  __m128i t = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s,1));
+  t = _mm_add_epi32(t, _mm_srli_si128(t,8));
+  t = _mm_add_epi32(t, _mm_srli_si128(t,4));
+  return _mm_cvtsi128_si32(t) + rowsum_scalar(p+j, n-j);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _sum16_avx2(__m256i s, const uint16_t* p)
+{
+  s = _mm256_add_epi32(s, _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p  ))));
+  return _mm256_add_epi32(s, _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p+8))));
+}
+
+__attribute__((target("avx2")))
+static inline int _hsum_avx2(__m256i s)
+{
+  __m128i t = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s,1));
+  t = _mm_add_epi32(t, _mm_srli_si128(t,8));
+  t = _mm_add_epi32(t, _mm_srli_si128(t,4));
+  return _mm_cvtsi128_si32(t);
+}
+
+__attribute__((target("avx2")))
+static void rowsum4_avx2(const uint16_t* const* p, unsigned n, int* out)
+{
+  __m256i s0 = _mm256_setzero_si256();
+  __m256i s1 = _mm256_setzero_si256();
+  __m256i s2 = _mm256_setzero_si256();
+  __m256i s3 = _mm256_setzero_si256();
+  unsigned j=0;
+  for(; j+16<=n; j+=16) {
+    s0 = _sum16_avx2(s0, p[0]+j);
+    s1 = _sum16_avx2(s1, p[1]+j);
+    s2 = _sum16_avx2(s2, p[2]+j);
+    s3 = _sum16_avx2(s3, p[3]+j);
+  }
+  out[0] = _hsum_avx2(s0) + rowsum_scalar(p[0]+j, n-j);
+  out[1] = _hsum_avx2(s1) + rowsum_scalar(p[1]+j, n-j);
+  out[2] = _hsum_avx2(s2) + rowsum_scalar(p[2]+j, n-j);
+  out[3] = _hsum_avx2(s3) + rowsum_scalar(p[3]+j, n-j);
+}
+
+__attribute__((target("avx2")))
+static void widen_avx2(const uint16_t* p, unsigned n, int ped, int* out)
+{
+  const __m256i vped = _mm256_set1_epi32(ped);
+  unsigned j=0;
+  for(; j+16<=n; j+=16) {
+    __m256i lo = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p+j  )));
+    __m256i hi = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p+j+8)));
+    _mm256_storeu_si256((__m256i*)(out+j  ), _mm256_sub_epi32(lo, vped));
+    _mm256_storeu_si256((__m256i*)(out+j+8), _mm256_sub_epi32(hi, vped));
+  }
+  widen_scalar(p+j, n-j, ped, out+j);
+}
+
+__attribute__((target("avx2")))
+static void subtract_avx2(const uint16_t* p, unsigned n, const int* d, int* out)
+{
+  unsigned j=0;
+  for(; j+16<=n; j+=16) {
+    __m256i lo = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p+j  )));
+    __m256i hi = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p+j+8)));
+    __m256i d0 = _mm256_loadu_si256((const __m256i*)(d+j  ));
+    __m256i d1 = _mm256_loadu_si256((const __m256i*)(d+j+8));
+    _mm256_storeu_si256((__m256i*)(out+j  ), _mm256_sub_epi32(lo, d0));
+    _mm256_storeu_si256((__m256i*)(out+j+8), _mm256_sub_epi32(hi, d1));
+  }
+  subtract_scalar(p+j, n-j, d+j, out+j);
+}
+
+__attribute__((target("avx512f")))
+static void accumulate_avx512(const uint16_t* p, unsigned n, int ped, int* acc)
+{
+  const __m512i vped = _mm512_set1_epi32(ped);
+  unsigned j=0;
+  for(; j+32<=n; j+=32) {
+    __m512i lo = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p+j   )));
+    __m512i hi = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p+j+16)));
+    _mm512_storeu_si512(acc+j   , _mm512_add_epi32(_mm512_loadu_si512(acc+j   ), _mm512_sub_epi32(lo, vped)));
+    _mm512_storeu_si512(acc+j+16, _mm512_add_epi32(_mm512_loadu_si512(acc+j+16), _mm512_sub_epi32(hi, vped)));
+  }
+  accumulate_scalar(p+j, n-j, ped, acc+j);
+}
+
+//
+//  Horizontal sum of sixteen int32 lanes (_mm512_reduce_add_epi32 is
+//  only provided from GCC 7)
+//
+__attribute__((target("avx512f")))
+static inline int _hsum_avx512(__m512i s)
+{
+  __m256i h = _mm256_add_epi32(_mm512_castsi512_si256(s), _mm512_extracti64x4_epi64(s,1));
+  __m128i t = _mm_add_epi32(_mm256_castsi256_si128(h), _mm256_extracti128_si256(h,1));
+  t = _mm_add_epi32(t, _mm_srli_si128(t,8));
+  t = _mm_add_epi32(t, _mm_srli_si128(t,4));
+  return _mm_cvtsi128_si32(t);
+}
+
+__attribute__((target("avx512f")))
+static int rowsum_avx512(const uint16_t* p, unsigned n)
+{
+  __m512i s = _mm512_setzero_si512();
+  unsigned j=0;
+  for(; j+32<=n; j+=32) {
+    s = _mm512_add_epi32(s, _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p+j   ))));
+    s = _mm512_add_epi32(s, _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p+j+16))));
+  }
+  return _hsum_avx512(s) + rowsum_scalar(p+j, n-j);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i _sum32_avx512(__m512i s, const uint16_t* p)
+{
+  s = _mm512_add_epi32(s, _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p   ))));
+  return _mm512_add_epi32(s, _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p+16))));
+}
+
+__attribute__((target("avx512f")))
+static void rowsum4_avx512(const uint16_t* const* p, unsigned n, int* out)
+{
+  __m512i s0 = _mm512_setzero_si512();
+  __m512i s1 = _mm512_setzero_si512();
+  __m512i s2 = _mm512_setzero_si512();
+  __m512i s3 = _mm512_setzero_si512();
+  unsigned j=0;
+  for(; j+32<=n; j+=32) {
+    s0 = _sum32_avx512(s0, p[0]+j);
+    s1 = _sum32_avx512(s1, p[1]+j);
+    s2 = _sum32_avx512(s2, p[2]+j);
+    s3 = _sum32_avx512(s3, p[3]+j);
+  }
+  out[0] = _hsum_avx512(s0) + rowsum_scalar(p[0]+j, n-j);
+  out[1] = _hsum_avx512(s1) + rowsum_scalar(p[1]+j, n-j);
+  out[2] = _hsum_avx512(s2) + rowsum_scalar(p[2]+j, n-j);
+  out[3] = _hsum_avx512(s3) + rowsum_scalar(p[3]+j, n-j);
+}
+
+__attribute__((target("avx512f")))
+static void widen_avx512(const uint16_t* p, unsigned n, int ped, int* out)
+{
+  const __m512i vped = _mm512_set1_epi32(ped);
+  unsigned j=0;
+  for(; j+32<=n; j+=32) {
+    __m512i lo = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p+j   )));
+    __m512i hi = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p+j+16)));
+    _mm512_storeu_si512(out+j   , _mm512_sub_epi32(lo, vped));
+    _mm512_storeu_si512(out+j+16, _mm512_sub_epi32(hi, vped));
+  }
+  widen_scalar(p+j, n-j, ped, out+j);
+}
+
+__attribute__((target("avx512f")))
+static void subtract_avx512(const uint16_t* p, unsigned n, const int* d, int* out)
+{
+  unsigned j=0;
+  for(; j+32<=n; j+=32) {
+    __m512i lo = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p+j   )));
+    __m512i hi = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p+j+16)));
+    __m512i d0 = _mm512_loadu_si512(d+j   );
+    __m512i d1 = _mm512_loadu_si512(d+j+16);
+    _mm512_storeu_si512(out+j   , _mm512_sub_epi32(lo, d0));
+    _mm512_storeu_si512(out+j+16, _mm512_sub_epi32(hi, d1));
+  }
+  subtract_scalar(p+j, n-j, d+j, out+j);
+}
+
+#endif
+
+static const Kernels _kernels[] = {
+#ifdef TT_SIMD
+  { "avx512", accumulate_avx512, rowsum_avx512, rowsum4_avx512, widen_avx512, subtract_avx512 },
+  { "avx2"  , accumulate_avx2  , rowsum_avx2  , rowsum4_avx2  , widen_avx2  , subtract_avx2   },
+  { "sse4"  , accumulate_sse4  , rowsum_sse4  , rowsum4_sse4  , widen_sse4  , subtract_sse4   },
+#endif
+  { "scalar", accumulate_scalar, rowsum_scalar, rowsum4_scalar, widen_scalar, subtract_scalar },
+  { NULL    , NULL             , NULL         , NULL          , NULL        , NULL            } };
+
+static bool _supported(const char* name)
+{
+#ifdef TT_SIMD
+  __builtin_cpu_init();
+  if (strcmp(name,"avx512")==0) return __builtin_cpu_supports("avx512f");
+  if (strcmp(name,"avx2"  )==0) return __builtin_cpu_supports("avx2");
+  if (strcmp(name,"sse4"  )==0) return __builtin_cpu_supports("sse4.1");
+#endif
+  return strcmp(name,"scalar")==0;
+}
+
+static const Kernels* _select()
+{
+  const Kernels* k = _kernels;
+  while(!_supported(k->name))
+    k++;
+  return k;
+}
+
+static const Kernels* _k = _select();
+
+const char* Projector::isa()
+{
+  return _k->name;
+}
+
+bool Projector::isa(const char* name)
+{
+  for(const Kernels* k = _kernels; k->name; k++)
+    if (strcmp(k->name,name)==0 && _supported(name)) {
+      _k = k;
+      return true;
+    }
+  return false;
+}
+
+//
+//  Complete n elements of a projection or ROI row: add them to the sum,
+//  apply the sideband correction and track the maximum
+//
+static void _correct(const int*    v,
+                     unsigned      n,
+                     const double* sbc,
+                     double*       out,
+                     double&       sum,
+                     double&       vmax)
+{
+  for(unsigned j=0; j<n; j++) {
+    sum += v[j];
+    double d = sbc ? double(v[j])-sbc[j] : double(v[j]);
+    out[j] = d;
+    if (d > vmax) vmax = d;
+  }
+}
+
+static double _sum(const int* v, unsigned n)
+{
+  double sum = 0;
+  for(unsigned j=0; j<n; j++)
+    sum += v[j];
+  return sum;
+}
+
+static double _sum(const int* v, unsigned n, int& vmax)
+{
+  double sum = 0;
+  for(unsigned j=0; j<n; j++) {
+    sum += v[j];
+    if (v[j] > vmax) vmax = v[j];
+  }
+  return sum;
+}
+
+double Projector::project(const ndarray<const uint16_t,2>& f,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          unsigned        pdim,
+                          int*            proj)
+{
+  double vmax;
+  return project(f, lo, hi, pedestal, pdim, NULL, proj, NULL, vmax);
+}
+
+double Projector::project(const ndarray<const uint16_t,2>& f,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          unsigned        pdim,
+                          int*            proj,
+                          int&            vmax)
+{
+  project(f, lo, hi, pedestal, pdim, proj);
+  return sum(proj, pdim==1 ? hi[1]-lo[1]+1 : hi[0]-lo[0]+1, vmax);
+}
+
+double Projector::project(const ndarray<const uint16_t,2>& f,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          unsigned        pdim,
+                          const double*   sbc,
+                          int*            proj,
+                          double*         projd,
+                          double&         vmax)
+{
+  const int      ped   = pedestal;
+  const unsigned ncols = hi[1]-lo[1]+1;
+  double sum = 0;
+  vmax = -DBL_MAX;
+
+  if (pdim==1) {
+    //
+    //  Accumulate rows into the projection, then complete each element
+    //
+    memset(proj, 0, ncols*sizeof(int));
+    for(unsigned i=lo[0]; i<=hi[0]; i++)
+      _k->accumulate(&f(i,lo[1]), ncols, ped, proj);
+    if (projd)
+      _correct(proj, ncols, sbc, projd, sum, vmax);
+    else
+      sum = _sum(proj, ncols);
+  }
+  else {
+    //
+    //  Each row reduces to a single projection element; rows are
+    //  reduced in blocks of four
+    //
+    const int rped = ped*int(ncols);
+    unsigned i=lo[0], k=0;
+    for(; i+4<=hi[0]+1; i+=4, k+=4) {
+      const uint16_t* p[4] = { &f(i,lo[1]), &f(i+1,lo[1]), &f(i+2,lo[1]), &f(i+3,lo[1]) };
+      _k->rowsum4(p, ncols, proj+k);
+    }
+    for(; i<=hi[0]; i++, k++)
+      proj[k] = _k->rowsum(&f(i,lo[1]), ncols);
+
+    for(k=0; k<hi[0]-lo[0]+1; k++)
+      proj[k] -= rped;
+    if (projd)
+      _correct(proj, k, sbc, projd, sum, vmax);
+    else
+      sum = _sum(proj, k);
+  }
+  return sum;
+}
+
+double Projector::roi(const ndarray<const uint16_t,2>& f,
+                      const unsigned* lo,
+                      const unsigned* hi,
+                      unsigned        pedestal,
+                      int*            roi)
+{
+  double vmax;
+  return Projector::roi(f, lo, hi, pedestal, NULL, roi, NULL, vmax);
+}
+
+double Projector::roi(const ndarray<const uint16_t,2>& f,
+                      const unsigned* lo,
+                      const unsigned* hi,
+                      unsigned        pedestal,
+                      int*            roi,
+                      int&            vmax)
+{
+  const int      ped   = pedestal;
+  const unsigned ncols = hi[1]-lo[1]+1;
+  double sum = 0;
+  vmax = INT_MIN;
+
+  for(unsigned i=lo[0]; i<=hi[0]; i++, roi+=ncols) {
+    _k->widen(&f(i,lo[1]), ncols, ped, roi);
+    sum += _sum(roi, ncols, vmax);
+  }
+  return sum;
+}
+
+double Projector::roi(const ndarray<const uint16_t,2>& f,
+                      const unsigned* lo,
+                      const unsigned* hi,
+                      unsigned        pedestal,
+                      const double*   sbc,
+                      int*            roi,
+                      double*         roid,
+                      double&         vmax)
+{
+  const int      ped   = pedestal;
+  const unsigned ncols = hi[1]-lo[1]+1;
+  double sum = 0;
+  vmax = -DBL_MAX;
+
+  //
+  //  Each row is widened and then completed while it is still in cache
+  //
+  for(unsigned i=lo[0]; i<=hi[0]; i++) {
+    _k->widen(&f(i,lo[1]), ncols, ped, roi);
+    if (roid) {
+      _correct(roi, ncols, sbc, roid, sum, vmax);
+      roid += ncols;
+      if (sbc) sbc += ncols;
+    }
+    else
+      sum += _sum(roi, ncols);
+    roi += ncols;
+  }
+  return sum;
+}
+
+double Projector::project(const ndarray<const uint16_t,2>& f,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          const int*      dproj,
+                          unsigned        pdim,
+                          int*            proj,
+                          int&            vmax)
+{
+  //
+  //  The projection of the pedestal map is subtracted from the
+  //  projection of the raw pixels
+  //
+  unsigned n = pdim==1 ? hi[1]-lo[1]+1 : hi[0]-lo[0]+1;
+  project(f, lo, hi, 0, pdim, proj);
+  for(unsigned j=0; j<n; j++)
+    proj[j] -= dproj[j];
+  return sum(proj, n, vmax);
+}
+
+double Projector::roi(const ndarray<const uint16_t,2>& f,
+                      const unsigned* lo,
+                      const unsigned* hi,
+                      const int*      dark,
+                      int*            roi,
+                      int&            vmax)
+{
+  const unsigned ncols = hi[1]-lo[1]+1;
+  double sum = 0;
+  vmax = INT_MIN;
+
+  for(unsigned i=lo[0]; i<=hi[0]; i++, roi+=ncols, dark+=ncols) {
+    _k->subtract(&f(i,lo[1]), ncols, dark, roi);
+    sum += _sum(roi, ncols, vmax);
+  }
+  return sum;
+}
+
+double Projector::roi(const ndarray<const uint16_t,2>& f,
+                      const unsigned* lo,
+                      const unsigned* hi,
+                      unsigned        pedestal,
+                      const int*      dark,
+                      const unsigned* bin,
+                      int*            roi,
+                      int&            vmax)
+{
+  const unsigned by    = bin[0];
+  const unsigned bx    = bin[1];
+  const unsigned nrows = (hi[0]-lo[0]+1)/by;
+  const unsigned ncols = (hi[1]-lo[1]+1)/bx;
+  const int      ped   = dark ? 0 : pedestal;
+  const int      bped  = ped*int(bx);
+  double sum = 0;
+  vmax = INT_MIN;
+
+  //
+  //  The rows of a bin are accumulated into the output row, with the
+  //  columns of a bin summed as each row is read
+  //
+  for(unsigned r=0; r<nrows; r++, roi+=ncols) {
+    memset(roi, 0, ncols*sizeof(int));
+    for(unsigned i=lo[0]+r*by; i<lo[0]+(r+1)*by; i++) {
+      const uint16_t* p = &f(i,lo[1]);
+      if (bx==1)
+        _k->accumulate(p, ncols, ped, roi);
+      else {
+        for(unsigned j=0; j<ncols; j++, p+=bx) {
+          int v = 0;
+          for(unsigned k=0; k<bx; k++)
+            v += p[k];
+          roi[j] += v-bped;
+        }
+      }
+    }
+    if (dark) {
+      for(unsigned j=0; j<ncols; j++)
+        roi[j] -= dark[j];
+      dark += ncols;
+    }
+    sum += _sum(roi, ncols, vmax);
+  }
+  return sum;
+}
+
+double Projector::project(const ndarray<const uint16_t,2>& f,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          const int*      dproj,
+                          unsigned        pdim,
+                          const Mask&     mask,
+                          int*            proj,
+                          int&            vmax)
+{
+  const int      ped = dproj ? 0 : pedestal;
+  const unsigned n   = pdim==1 ? hi[1]-lo[1]+1 : hi[0]-lo[0]+1;
+  const std::vector<Mask::Run>& runs = mask.runs();
+
+  //
+  //  Only the runs of unmasked pixels are read
+  //
+  memset(proj, 0, n*sizeof(int));
+  if (pdim==1) {
+    for(unsigned i=0; i<runs.size(); i++) {
+      const Mask::Run& r = runs[i];
+      _k->accumulate(&f(lo[0]+r.row,lo[1]+r.col), r.n, ped, proj+r.col);
+    }
+  }
+  else {
+    for(unsigned i=0; i<runs.size(); i++) {
+      const Mask::Run& r = runs[i];
+      proj[r.row] += _k->rowsum(&f(lo[0]+r.row,lo[1]+r.col), r.n) - ped*int(r.n);
+    }
+  }
+
+  if (dproj)
+    for(unsigned j=0; j<n; j++)
+      proj[j] -= dproj[j];
+
+  mask.fill(proj);
+
+  return sum(proj, n, vmax);
+}
+
+void Projector::project(const ndarray<const uint16_t,2>& f,
+                        unsigned        pdim,
+                        Region*         regions,
+                        unsigned        n)
+{
+  unsigned row_lo = UINT_MAX, row_hi = 0;
+  for(unsigned k=0; k<n; k++) {
+    Region& g = regions[k];
+    unsigned nb = pdim==1 ? g.hi[1]-g.lo[1]+1 : g.hi[0]-g.lo[0]+1;
+    memset(g.proj, 0, nb*sizeof(int));
+    g.run = 0;
+    if (g.mask && g.mask->empty())
+      g.mask = 0;
+    if (g.lo[0] < row_lo) row_lo = g.lo[0];
+    if (g.hi[0] > row_hi) row_hi = g.hi[0];
+  }
+
+  //
+  //  Each frame row is read once for all of the regions that contain it
+  //
+  for(unsigned i=row_lo; i<=row_hi; i++) {
+    for(unsigned k=0; k<n; k++) {
+      Region& g = regions[k];
+      if (i < g.lo[0] || i > g.hi[0])
+        continue;
+      const int      ped   = g.dproj ? 0 : g.pedestal;
+      const unsigned r     = i-g.lo[0];
+      const unsigned ncols = g.hi[1]-g.lo[1]+1;
+      if (g.mask) {
+        const std::vector<Mask::Run>& runs = g.mask->runs();
+        for(; g.run<runs.size() && runs[g.run].row==r; g.run++) {
+          const Mask::Run& m = runs[g.run];
+          if (pdim==1)
+            _k->accumulate(&f(i,g.lo[1]+m.col), m.n, ped, g.proj+m.col);
+          else
+            g.proj[r] += _k->rowsum(&f(i,g.lo[1]+m.col), m.n) - ped*int(m.n);
+        }
+      }
+      else if (pdim==1)
+        _k->accumulate(&f(i,g.lo[1]), ncols, ped, g.proj);
+      else
+        g.proj[r] = _k->rowsum(&f(i,g.lo[1]), ncols) - ped*int(ncols);
+    }
+  }
+
+  for(unsigned k=0; k<n; k++) {
+    Region& g = regions[k];
+    unsigned nb = pdim==1 ? g.hi[1]-g.lo[1]+1 : g.hi[0]-g.lo[0]+1;
+    if (g.dproj)
+      for(unsigned j=0; j<nb; j++)
+        g.proj[j] -= g.dproj[j];
+    if (g.mask)
+      g.mask->fill(g.proj);
+    g.sum = sum(g.proj, nb, g.vmax);
+  }
+}
+
+double Projector::sum(const int* in,
+                      unsigned   n,
+                      int&       vmax)
+{
+  vmax = INT_MIN;
+  return _sum(in, n, vmax);
+}
+
+double Projector::maximum(const int*    in,
+                          unsigned      n,
+                          const double* sbc)
+{
+  double vmax = -DBL_MAX;
+  for(unsigned i=0; i<n; i++) {
+    double d = double(in[i])-sbc[i];
+    if (d > vmax) vmax = d;
+  }
+  return vmax;
+}
+
+double Projector::maximum(const int*    in,
+                          unsigned      rows,
+                          unsigned      cols,
+                          const double* means)
+{
+  const unsigned h = cols/2;
+  double vmax = -DBL_MAX;
+  for(unsigned i=0; i<rows; i++, in+=cols, means+=4)
+    for(unsigned j=0; j<cols; j++) {
+      double d = double(in[j]) - means[(j<h ? 0:2) + (j&1)];
+      if (d > vmax) vmax = d;
+    }
+  return vmax;
+}
+
+double Projector::correct(const int*    in,
+                          unsigned      n,
+                          const double* sbc,
+                          double*       out,
+                          double&       vmax)
+{
+  double sum = 0;
+  vmax = -DBL_MAX;
+  if (sbc) {
+    for(unsigned i=0; i<n; i++) {
+      sum += in[i];
+      double d = double(in[i])-sbc[i];
+      out[i] = d;
+      if (d > vmax) vmax = d;
+    }
+  }
+  else {
+    for(unsigned i=0; i<n; i++) {
+      sum += in[i];
+      double d = double(in[i]);
+      out[i] = d;
+      if (d > vmax) vmax = d;
+    }
+  }
+  return sum;
+}
+
+template<class T>
+static void _project(const double* in,
+                     unsigned      rows,
+                     unsigned      cols,
+                     unsigned      pdim,
+                     T*            out)
+{
+  if (pdim==1) {
+    for(unsigned j=0; j<cols; j++)
+      out[j] = 0;
+    for(unsigned i=0; i<rows; i++, in+=cols)
+      for(unsigned j=0; j<cols; j++)
+        out[j] += in[j];
+  }
+  else {
+    for(unsigned i=0; i<rows; i++, in+=cols) {
+      double v = 0;
+      for(unsigned j=0; j<cols; j++)
+        v += in[j];
+      out[i] = v;
+    }
+  }
+}
+
+void Projector::project(const double* in,
+                        unsigned      rows,
+                        unsigned      cols,
+                        unsigned      pdim,
+                        double*       out)
+{
+  _project(in, rows, cols, pdim, out);
+}
+
+void Projector::project(const double* in,
+                        unsigned      rows,
+                        unsigned      cols,
+                        unsigned      pdim,
+                        float*        out)
+{
+  _project(in, rows, cols, pdim, out);
+}
+
+static const double _no_sideband[4] = { 0, 0, 0, 0 };
+
+//
+//  Rows of the streamed normalization onto dimension P.  The sideband
+//  correction of an element is the mean of its group in the row (left
+//  or right half, even or odd element).  With a reference region the
+//  corrected reference row is projected and added to the rolling
+//  average first, and the signal row is normalized by the reciprocal of
+//  the updated average; else by rinv.  One row is live at a time.
+//
+template<unsigned P, class T>
+static void _normalize(const int*    in,
+                       const int*    ref,
+                       unsigned      rows,
+                       unsigned      cols,
+                       const double* means,
+                       double        fraction,
+                       double*       avg,
+                       const double* rinv,
+                       double        offset,
+                       double*       refp,
+                       double*       raw,
+                       T*            out)
+{
+  const unsigned h  = cols/2;
+  const unsigned dm = means ? 4:0;
+  const double*  m  = means ? means : _no_sideband;
+  const double   g  = 1-fraction;
+
+  if (P==1) {
+    for(unsigned j=0; j<cols; j++)
+      raw[j] = out[j] = 0;
+    if (ref)
+      for(unsigned j=0; j<cols; j++)
+        refp[j] = 0;
+  }
+
+  for(unsigned i=0; i<rows; i++, in+=cols, m+=dm) {
+    if (ref) {
+      double u = 0;
+      for(unsigned j=0; j<cols; j++) {
+        double r = double(ref[j]) - m[(j<h ? 0:2) + (j&1)];
+        if (P==1) refp[j] += r;
+        else      u       += r;
+        avg[j] = g*avg[j] + fraction*r;
+      }
+      if (P==0) refp[i] = u;
+      ref += cols;
+    }
+
+    double v = 0, w = 0;
+    for(unsigned j=0; j<cols; j++) {
+      double d = double(in[j]) - m[(j<h ? 0:2) + (j&1)];
+      double q = avg ? 1./avg[j] : rinv[j];
+      if (P==1) {
+        raw[j] += d;
+        out[j] += d*q - offset;
+      }
+      else {
+        v += d;
+        w += d*q - offset;
+      }
+    }
+    if (P==0) {
+      raw[i] = v;
+      out[i] = w;
+    }
+
+    if (avg) avg  += cols;
+    else     rinv += cols;
+  }
+}
+
+template<class T>
+static void _normalize(const int*    in,
+                       const int*    ref,
+                       unsigned      rows,
+                       unsigned      cols,
+                       const double* means,
+                       double        fraction,
+                       double*       avg,
+                       const double* rinv,
+                       double        offset,
+                       unsigned      pdim,
+                       double*       refp,
+                       double*       raw,
+                       T*            out)
+{
+  if (pdim==1)
+    _normalize<1>(in, ref, rows, cols, means, fraction, avg, rinv, offset, refp, raw, out);
+  else
+    _normalize<0>(in, ref, rows, cols, means, fraction, avg, rinv, offset, refp, raw, out);
+}
+
+void Projector::normalize(const int*    in,
+                          unsigned      rows,
+                          unsigned      cols,
+                          const double* means,
+                          const double* rinv,
+                          double        offset,
+                          unsigned      pdim,
+                          double*       raw,
+                          double*       out)
+{
+  _normalize(in, (const int*)0, rows, cols, means, 0., (double*)0, rinv, offset,
+             pdim, (double*)0, raw, out);
+}
+
+void Projector::normalize(const int*    in,
+                          unsigned      rows,
+                          unsigned      cols,
+                          const double* means,
+                          const double* rinv,
+                          double        offset,
+                          unsigned      pdim,
+                          double*       raw,
+                          float*        out)
+{
+  _normalize(in, (const int*)0, rows, cols, means, 0., (double*)0, rinv, offset,
+             pdim, (double*)0, raw, out);
+}
+
+void Projector::normalize(const int*    in,
+                          const int*    ref,
+                          unsigned      rows,
+                          unsigned      cols,
+                          const double* means,
+                          double        fraction,
+                          double*       avg,
+                          double        offset,
+                          unsigned      pdim,
+                          double*       refp,
+                          double*       raw,
+                          double*       out)
+{
+  _normalize(in, ref, rows, cols, means, fraction, avg, (const double*)0, offset,
+             pdim, refp, raw, out);
+}
+
+void Projector::normalize(const int*    in,
+                          const int*    ref,
+                          unsigned      rows,
+                          unsigned      cols,
+                          const double* means,
+                          double        fraction,
+                          double*       avg,
+                          double        offset,
+                          unsigned      pdim,
+                          double*       refp,
+                          double*       raw,
+                          float*        out)
+{
+  _normalize(in, ref, rows, cols, means, fraction, avg, (const double*)0, offset,
+             pdim, refp, raw, out);
+}
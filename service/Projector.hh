@@ -0,0 +1,231 @@
+#ifndef TimeTool_Projector_hh
+#define TimeTool_Projector_hh
+
+#include "ndarray/ndarray.h"
+
+#include <stdint.h>
+
+namespace TimeTool {
+
+  class Mask;
+
+  //
+  //  Fused projection kernels.  Each frame ROI pixel is read once and
+  //  the pedestal subtracted projection, the ROI sum, the sideband
+  //  corrected double result, and its maximum (for the projection cut)
+  //  are all produced in the same pass.
+  //
+  //  pdim is the frame dimension that is kept (1 projects onto X).
+  //
+  //  The integer passes also return the maximum of the pedestal
+  //  subtracted result, so that events can be cut before any sideband
+  //  or double precision work is done.
+  //
+  //  The integer part of the frame pass uses SSE4.1, AVX2 or AVX-512
+  //  kernels selected at load time from the CPU features, with a
+  //  scalar fallback.  All kernels give identical results.
+  //
+  class Projector {
+  public:
+    //  One projected ROI of a multiple region frame pass
+    struct Region {
+      const unsigned* lo;
+      const unsigned* hi;
+      const Mask*     mask;   // skip list, or NULL
+      const int*      dproj;  // pedestal projection, or NULL for the scalar pedestal
+      unsigned        pedestal; // scalar pedestal
+      int*            proj;
+      double          sum;    // ROI sum   (result)
+      int             vmax;   // maximum   (result)
+      unsigned        run;    // next mask run (internal)
+    };
+  public:
+    //  Name of the kernel set in use
+    static const char* isa();
+    //  Select a kernel set by name ("avx512","avx2","sse4","scalar");
+    //  returns false if unsupported on this CPU.  Not thread safe.
+    static bool        isa(const char*);
+    //  Projection only; returns the ROI sum
+    static double project(const ndarray<const uint16_t,2>& frame,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          unsigned        pdim,
+                          int*            proj);
+    //  Projection and its maximum; returns the ROI sum
+    static double project(const ndarray<const uint16_t,2>& frame,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          unsigned        pdim,
+                          int*            proj,
+                          int&            vmax);
+    //  Projection, sideband correction (sbc may be NULL) and maximum;
+    //  returns the ROI sum
+    static double project(const ndarray<const uint16_t,2>& frame,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          unsigned        pdim,
+                          const double*   sbc,
+                          int*            proj,
+                          double*         projd,
+                          double&         vmax);
+    //  Full ROI extraction; returns the ROI sum
+    static double roi    (const ndarray<const uint16_t,2>& frame,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          int*            roi);
+    //  Full ROI extraction and its maximum; returns the ROI sum
+    static double roi    (const ndarray<const uint16_t,2>& frame,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          int*            roi,
+                          int&            vmax);
+    //  Full ROI extraction, sideband correction (sbc may be NULL)
+    //  and maximum; returns the ROI sum
+    static double roi    (const ndarray<const uint16_t,2>& frame,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          const double*   sbc,
+                          int*            roi,
+                          double*         roid,
+                          double&         vmax);
+    //  Projection with a per-pixel pedestal, given as the projection of
+    //  the pedestal map over the ROI, and its maximum; returns the sum
+    static double project(const ndarray<const uint16_t,2>& frame,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          const int*      pedestal_proj,
+                          unsigned        pdim,
+                          int*            proj,
+                          int&            vmax);
+    //  Full ROI extraction with a per-pixel pedestal map of the ROI
+    //  shape, and its maximum; returns the ROI sum
+    static double roi    (const ndarray<const uint16_t,2>& frame,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          const int*      pedestal_map,
+                          int*            roi,
+                          int&            vmax);
+    //  Full ROI extraction binned by bin[0] rows and bin[1] columns, with
+    //  the scalar pedestal or a binned pedestal map (if given), and its
+    //  maximum; returns the ROI sum.  Partial bins at the upper edges of
+    //  the ROI are dropped.
+    static double roi    (const ndarray<const uint16_t,2>& frame,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          const int*      pedestal_map,
+                          const unsigned* bin,
+                          int*            roi,
+                          int&            vmax);
+    //  Projection of the unmasked pixels, completed by the mask, and its
+    //  maximum.  The pedestal projection over the unmasked pixels is
+    //  subtracted if given (else the scalar pedestal).  Returns the sum.
+    static double project(const ndarray<const uint16_t,2>& frame,
+                          const unsigned* lo,
+                          const unsigned* hi,
+                          unsigned        pedestal,
+                          const int*      pedestal_proj,
+                          unsigned        pdim,
+                          const Mask&     mask,
+                          int*            proj,
+                          int&            vmax);
+    //  Projection of n regions onto pdim in a single traversal of the
+    //  frame rows, so that regions sharing rows share their cache lines
+    static void   project(const ndarray<const uint16_t,2>& frame,
+                          unsigned        pdim,
+                          Region*         regions,
+                          unsigned        n);
+    //  Sum and maximum of n elements; returns the sum
+    static double sum    (const int*      in,
+                          unsigned        n,
+                          int&            vmax);
+    //  Maximum of n sideband corrected elements (no copy is made)
+    static double maximum(const int*      in,
+                          unsigned        n,
+                          const double*   sbc);
+    //  Maximum of a rows x cols region corrected by the common mode of
+    //  its rows (means, rows x 4 as Filter::lroe_means)
+    static double maximum(const int*      in,
+                          unsigned        rows,
+                          unsigned        cols,
+                          const double*   means);
+    //  Sideband correction of an existing projection or ROI of n
+    //  elements (sbc may be NULL); returns the sum of the input
+    static double correct(const int*      in,
+                          unsigned        n,
+                          const double*   sbc,
+                          double*         out,
+                          double&         vmax);
+    //  Projection of a rows x cols double region onto out
+    static void   project(const double*   in,
+                          unsigned        rows,
+                          unsigned        cols,
+                          unsigned        pdim,
+                          double*         out);
+    static void   project(const double*   in,
+                          unsigned        rows,
+                          unsigned        cols,
+                          unsigned        pdim,
+                          float*          out);
+    //  Streamed normalization of a rows x cols integer region: each
+    //  element is corrected by the sideband common mode of its row
+    //  (means, rows x 4 as Filter::lroe_means, may be NULL) and
+    //  projected onto raw, then multiplied by rinv, offset and projected
+    //  onto out.  No corrected copy of the region is made.  out may be
+    //  single precision.
+    static void   normalize(const int*    in,
+                            unsigned      rows,
+                            unsigned      cols,
+                            const double* means,
+                            const double* rinv,
+                            double        offset,
+                            unsigned      pdim,
+                            double*       raw,
+                            double*       out);
+    static void   normalize(const int*    in,
+                            unsigned      rows,
+                            unsigned      cols,
+                            const double* means,
+                            const double* rinv,
+                            double        offset,
+                            unsigned      pdim,
+                            double*       raw,
+                            float*        out);
+    //  As above, with the reference region ref updated in the same pass:
+    //  each corrected reference row is projected onto refp and added to
+    //  the rolling average avg with weight fraction, and the signal row
+    //  is multiplied by the reciprocal of the updated row of avg
+    static void   normalize(const int*    in,
+                            const int*    ref,
+                            unsigned      rows,
+                            unsigned      cols,
+                            const double* means,
+                            double        fraction,
+                            double*       avg,
+                            double        offset,
+                            unsigned      pdim,
+                            double*       refp,
+                            double*       raw,
+                            double*       out);
+    static void   normalize(const int*    in,
+                            const int*    ref,
+                            unsigned      rows,
+                            unsigned      cols,
+                            const double* means,
+                            double        fraction,
+                            double*       avg,
+                            double        offset,
+                            unsigned      pdim,
+                            double*       refp,
+                            double*       raw,
+                            float*        out);
+  };
+};
+
+#endif
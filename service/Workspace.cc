@@ -0,0 +1,101 @@
+#include "Workspace.hh"
+
+using namespace TimeTool;
+
+Workspace::Workspace() : _allocations(0)
+{
+  reset_working_set();
+}
+
+Workspace::~Workspace()
+{
+}
+
+ndarray<int,1>& Workspace::i1(IntBuffer b, unsigned n)
+{
+  ndarray<int,1>& a = _i1[b];
+  if (a.size()!=n) {
+    a = make_ndarray<int>(n);
+    _allocations++;
+  }
+  _used_i1 |= 1<<b;
+  return a;
+}
+
+ndarray<int,2>& Workspace::i2(IntBuffer b, unsigned rows, unsigned cols)
+{
+  ndarray<int,2>& a = _i2[b];
+  if (a.size()!=rows*cols || a.shape()[0]!=rows) {
+    a = make_ndarray<int>(rows,cols);
+    _allocations++;
+  }
+  _used_i2 |= 1<<b;
+  return a;
+}
+
+ndarray<double,1>& Workspace::d1(DoubleBuffer b, unsigned n)
+{
+  ndarray<double,1>& a = _d1[b];
+  if (a.size()!=n) {
+    a = make_ndarray<double>(n);
+    _allocations++;
+  }
+  _used_d1 |= 1<<b;
+  return a;
+}
+
+ndarray<double,2>& Workspace::d2(DoubleBuffer b, unsigned rows, unsigned cols)
+{
+  ndarray<double,2>& a = _d2[b];
+  if (a.size()!=rows*cols || a.shape()[0]!=rows) {
+    a = make_ndarray<double>(rows,cols);
+    _allocations++;
+  }
+  _used_d2 |= 1<<b;
+  return a;
+}
+
+ndarray<float,1>& Workspace::f1(FloatBuffer b, unsigned n)
+{
+  ndarray<float,1>& a = _f1[b];
+  if (a.size()!=n) {
+    a = make_ndarray<float>(n);
+    _allocations++;
+  }
+  _used_f1 |= 1<<b;
+  return a;
+}
+
+std::vector<Projector::Region>& Workspace::regions(unsigned n)
+{
+  if (_regions.size()!=n) {
+    _regions.resize(n);
+    _allocations++;
+  }
+  return _regions;
+}
+
+template<class T, unsigned N>
+static unsigned long _bytes(const ndarray<T,N>* a, unsigned n, unsigned used)
+{
+  unsigned long sz = 0;
+  for(unsigned i=0; i<n; i++)
+    if (used & (1<<i))
+      sz += a[i].size()*sizeof(T);
+  return sz;
+}
+
+unsigned long Workspace::working_set() const
+{
+  return
+    _bytes(_i1, NIntBuffers   , _used_i1) +
+    _bytes(_i2, NIntBuffers   , _used_i2) +
+    _bytes(_d1, NDoubleBuffers, _used_d1) +
+    _bytes(_d2, NDoubleBuffers, _used_d2) +
+    _bytes(_f1, NFloatBuffers , _used_f1);
+}
+
+void Workspace::reset_working_set()
+{
+  _used_i1 = _used_i2 = _used_d1 = _used_d2 = _used_f1 = 0;
+}
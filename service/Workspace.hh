@@ -0,0 +1,66 @@
+#ifndef TimeTool_Workspace_hh
+#define TimeTool_Workspace_hh
+
+#include "Projector.hh"
+#include "ndarray/ndarray.h"
+
+#include <vector>
+
+namespace TimeTool {
+
+  //
+  //  Per-Fex scratch buffers.  The buffers are sized from the ROI
+  //  geometry when the Fex is configured and are reused for every
+  //  event.  A buffer is only reallocated when an event requires a
+  //  different shape (frame clipping or externally projected input);
+  //  each such allocation is counted so that the steady state can be
+  //  verified to be free of heap traffic.
+  //
+  class Workspace {
+  public:
+    enum IntBuffer    { SigRaw, SbRaw, RefRaw,
+                        DarkSig, DarkSb, DarkRef, Profile, NIntBuffers };
+    enum DoubleBuffer { SigCorr, RefCorr, SbCorr, SigProj, SubProj, RefProj,
+                        RefInv, RefAvgProj, Filtered, FilteredCmp, Coarse, CoarseFiltered,
+                        FitParams, FitErrors, FitModel, DarkSum, SigProjCmp,
+                        SbMeans, NDoubleBuffers };
+    //  Single precision projection and filter output
+    enum FloatBuffer  { SigProjF, FilteredF, NFloatBuffers };
+  public:
+    Workspace();
+    ~Workspace();
+  public:
+    //  Buffers of exactly the requested shape
+    ndarray<int,1>&    i1(IntBuffer,    unsigned n);
+    ndarray<int,2>&    i2(IntBuffer,    unsigned rows, unsigned cols);
+    ndarray<double,1>& d1(DoubleBuffer, unsigned n);
+    ndarray<double,2>& d2(DoubleBuffer, unsigned rows, unsigned cols);
+    ndarray<float,1>&  f1(FloatBuffer,  unsigned n);
+    //  Buffers of the same shape as a
+    ndarray<double,1>& d (DoubleBuffer b, const ndarray<const int,1>& a)
+    { return d1(b, a.shape()[0]); }
+    ndarray<double,2>& d (DoubleBuffer b, const ndarray<const int,2>& a)
+    { return d2(b, a.shape()[0], a.shape()[1]); }
+    //  Region list of a multiple region frame pass
+    std::vector<Projector::Region>& regions(unsigned n);
+  public:
+    //  Number of allocations since the last reset
+    unsigned allocations() const { return _allocations; }
+    void     reset_allocations() { _allocations = 0; }
+    //  Size in bytes of the distinct buffers handed out since the last
+    //  reset, the scratch working set of the events in between
+    unsigned long working_set() const;
+    void          reset_working_set();
+  private:
+    ndarray<int,1>    _i1[NIntBuffers];
+    ndarray<int,2>    _i2[NIntBuffers];
+    ndarray<double,1> _d1[NDoubleBuffers];
+    ndarray<double,2> _d2[NDoubleBuffers];
+    ndarray<float,1>  _f1[NFloatBuffers];
+    std::vector<Projector::Region> _regions;
+    unsigned          _allocations;
+    unsigned          _used_i1, _used_i2, _used_d1, _used_d2, _used_f1;
+  };
+};
+
+#endif
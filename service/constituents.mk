@@ -5,7 +5,7 @@ libincs_ttsvc := pdsdata/include
 libincs_ttsvc += psalg/include ndarray/include boost/include
 libincs_ttsvc += gsl/include
 
-special_include_files := Fex.hh FrameCache.hh
+special_include_files := Fex.hh FrameCache.hh Filter.hh Projector.hh
 special_include_files := $(patsubst %,$(RELEASE_DIR)/build/timetool/include/timetool/service/%,$(special_include_files))
 
 userall: $(special_include_files)